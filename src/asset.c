@@ -0,0 +1,192 @@
+#include "asset.h"
+#include "debug.h"
+#include "heap.h"
+#include "vec3f.h"
+#include "l4z/xxhash.h"
+
+#include <string.h>
+
+static uint32_t asset_align(uint32_t offset)
+{
+	return (offset + k_asset_section_alignment - 1) & ~(uint32_t)(k_asset_section_alignment - 1);
+}
+
+// Allocates a zeroed blob so the padding between sections hashes the same every cook.
+static char* asset_alloc_blob(heap_t* heap, size_t size)
+{
+	char* blob = heap_alloc(heap, size, k_asset_section_alignment);
+	memset(blob, 0, size);
+	return blob;
+}
+
+static uint64_t asset_hash_sections(const char* blob, size_t header_size, size_t blob_size)
+{
+	return XXH64(blob + header_size, blob_size - header_size, 0);
+}
+
+bool asset_cook_mesh(heap_t* heap, const asset_mesh_source_t* source, gpu_mesh_layout_t layout, void** blob, size_t* blob_size)
+{
+	bool has_color;
+	switch (layout)
+	{
+	case k_gpu_mesh_layout_tri_p444_i2:
+		has_color = false;
+		break;
+	case k_gpu_mesh_layout_tri_p444_c444_i2:
+		has_color = true;
+		break;
+	default:
+		debug_print(k_print_error, "Asset: unknown mesh layout %d\n", layout);
+		return false;
+	}
+
+	if (has_color && !source->colors)
+	{
+		debug_print(k_print_error, "Asset: mesh layout %d needs vertex colors\n", layout);
+		return false;
+	}
+	// Both layouts are triangle lists with 16-bit indices.
+	if (source->vertex_count > UINT16_MAX + 1 || source->index_count % 3 != 0)
+	{
+		debug_print(k_print_error, "Asset: mesh does not fit layout %d\n", layout);
+		return false;
+	}
+	for (int i = 0; i < source->index_count; ++i)
+	{
+		if (source->indices[i] >= (uint32_t)source->vertex_count)
+		{
+			debug_print(k_print_error, "Asset: mesh index %u is out of range\n", source->indices[i]);
+			return false;
+		}
+	}
+
+	uint32_t vertex_stride = (uint32_t)sizeof(vec3f_t) * (has_color ? 2 : 1);
+	uint32_t vertex_data_offset = asset_align(sizeof(asset_mesh_header_t));
+	uint32_t vertex_data_size = vertex_stride * source->vertex_count;
+	uint32_t index_data_offset = asset_align(vertex_data_offset + vertex_data_size);
+	uint32_t index_data_size = (uint32_t)sizeof(uint16_t) * source->index_count;
+	size_t size = (size_t)index_data_offset + index_data_size;
+	char* data = asset_alloc_blob(heap, size);
+
+	vec3f_t* vertex = (vec3f_t*)(data + vertex_data_offset);
+	for (int i = 0; i < source->vertex_count; ++i)
+	{
+		*vertex++ = source->positions[i];
+		if (has_color)
+		{
+			*vertex++ = source->colors[i];
+		}
+	}
+	uint16_t* index = (uint16_t*)(data + index_data_offset);
+	for (int i = 0; i < source->index_count; ++i)
+	{
+		index[i] = (uint16_t)source->indices[i];
+	}
+
+	asset_mesh_header_t* header = (asset_mesh_header_t*)data;
+	header->magic = k_asset_magic_mesh;
+	header->version = k_asset_version;
+	header->layout = layout;
+	header->vertex_data_offset = vertex_data_offset;
+	header->vertex_data_size = vertex_data_size;
+	header->index_data_offset = index_data_offset;
+	header->index_data_size = index_data_size;
+	header->content_hash = asset_hash_sections(data, sizeof(*header), size);
+
+	*blob = data;
+	*blob_size = size;
+	return true;
+}
+
+bool asset_cook_shader(heap_t* heap, const void* vertex_shader, size_t vertex_shader_size, const void* fragment_shader, size_t fragment_shader_size, int uniform_buffer_count, void** blob, size_t* blob_size)
+{
+	if (vertex_shader_size > UINT32_MAX / 2 || fragment_shader_size > UINT32_MAX / 2)
+	{
+		debug_print(k_print_error, "Asset: shader is too large\n");
+		return false;
+	}
+
+	uint32_t vertex_shader_offset = asset_align(sizeof(asset_shader_header_t));
+	uint32_t fragment_shader_offset = asset_align(vertex_shader_offset + (uint32_t)vertex_shader_size);
+	size_t size = (size_t)fragment_shader_offset + fragment_shader_size;
+	char* data = asset_alloc_blob(heap, size);
+	memcpy(data + vertex_shader_offset, vertex_shader, vertex_shader_size);
+	memcpy(data + fragment_shader_offset, fragment_shader, fragment_shader_size);
+
+	asset_shader_header_t* header = (asset_shader_header_t*)data;
+	header->magic = k_asset_magic_shader;
+	header->version = k_asset_version;
+	header->vertex_shader_offset = vertex_shader_offset;
+	header->vertex_shader_size = (uint32_t)vertex_shader_size;
+	header->fragment_shader_offset = fragment_shader_offset;
+	header->fragment_shader_size = (uint32_t)fragment_shader_size;
+	header->uniform_buffer_count = uniform_buffer_count;
+	header->content_hash = asset_hash_sections(data, sizeof(*header), size);
+
+	*blob = data;
+	*blob_size = size;
+	return true;
+}
+
+bool asset_mesh_load(const void* blob, size_t blob_size, gpu_mesh_info_t* info)
+{
+	const asset_mesh_header_t* header = blob;
+	if (!blob ||
+		blob_size < sizeof(*header) ||
+		header->magic != k_asset_magic_mesh ||
+		header->version != k_asset_version ||
+		header->layout >= k_gpu_mesh_layout_count ||
+		(uint64_t)header->vertex_data_offset + header->vertex_data_size > blob_size ||
+		(uint64_t)header->index_data_offset + header->index_data_size > blob_size)
+	{
+		return false;
+	}
+
+	*info = (gpu_mesh_info_t)
+	{
+		.layout = header->layout,
+		.vertex_data = (char*)blob + header->vertex_data_offset,
+		.vertex_data_size = header->vertex_data_size,
+		.index_data = (char*)blob + header->index_data_offset,
+		.index_data_size = header->index_data_size,
+	};
+	return true;
+}
+
+bool asset_shader_load(const void* blob, size_t blob_size, gpu_shader_info_t* info)
+{
+	const asset_shader_header_t* header = blob;
+	if (!blob ||
+		blob_size < sizeof(*header) ||
+		header->magic != k_asset_magic_shader ||
+		header->version != k_asset_version ||
+		(uint64_t)header->vertex_shader_offset + header->vertex_shader_size > blob_size ||
+		(uint64_t)header->fragment_shader_offset + header->fragment_shader_size > blob_size)
+	{
+		return false;
+	}
+
+	*info = (gpu_shader_info_t)
+	{
+		.vertex_shader_data = (char*)blob + header->vertex_shader_offset,
+		.vertex_shader_size = header->vertex_shader_size,
+		.fragment_shader_data = (char*)blob + header->fragment_shader_offset,
+		.fragment_shader_size = header->fragment_shader_size,
+		.uniform_buffer_count = header->uniform_buffer_count,
+	};
+	return true;
+}
+
+uint64_t asset_get_content_hash(const void* blob, size_t blob_size)
+{
+	// Both headers start with magic, version and content_hash.
+	const asset_mesh_header_t* header = blob;
+	if (!blob ||
+		blob_size < sizeof(asset_mesh_header_t) ||
+		(header->magic != k_asset_magic_mesh && header->magic != k_asset_magic_shader) ||
+		header->version != k_asset_version)
+	{
+		return 0;
+	}
+	return header->content_hash;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "gpu.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Cooked assets
+//
+// Meshes and shaders are cooked offline into blobs that are already laid out the way the gpu
+// consumes them: a small header followed by the data sections, each 16-byte aligned.
+// Loading a blob is a bounds check and pointer arithmetic, so load time is just the read.
+//
+// Every blob carries the 64-bit xxHash of its data sections, which identifies its content.
+// Blobs may be written with fs_write compression (or packed with LZ4); the fs decodes them on
+// read, so the loader never sees compressed data.
+
+typedef struct heap_t heap_t;
+typedef struct vec3f_t vec3f_t;
+
+enum
+{
+	k_asset_magic_mesh = 0x48534d41, // "AMSH"
+	k_asset_magic_shader = 0x52485341, // "ASHR"
+	k_asset_version = 1,
+	k_asset_section_alignment = 16,
+};
+
+typedef struct asset_mesh_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t content_hash;
+	uint32_t layout;
+	uint32_t vertex_data_offset;
+	uint32_t vertex_data_size;
+	uint32_t index_data_offset;
+	uint32_t index_data_size;
+	uint32_t reserved[3];
+} asset_mesh_header_t;
+
+typedef struct asset_shader_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t content_hash;
+	uint32_t vertex_shader_offset;
+	uint32_t vertex_shader_size;
+	uint32_t fragment_shader_offset;
+	uint32_t fragment_shader_size;
+	uint32_t uniform_buffer_count;
+	uint32_t reserved[3];
+} asset_shader_header_t;
+
+// A mesh as authored, before it is laid out for the gpu.
+typedef struct asset_mesh_source_t
+{
+	const vec3f_t* positions;
+	// Per-vertex colors. May be NULL if the target layout has no color.
+	const vec3f_t* colors;
+	int vertex_count;
+	const uint32_t* indices;
+	int index_count;
+} asset_mesh_source_t;
+
+// Cook a source mesh into a blob interleaved for the given layout.
+// The blob is allocated from heap; the caller frees it.
+// Returns false if the source lacks an attribute the layout needs or an index does not fit.
+bool asset_cook_mesh(heap_t* heap, const asset_mesh_source_t* source, gpu_mesh_layout_t layout, void** blob, size_t* blob_size);
+
+// Cook a vertex and fragment shader pair into a single blob.
+// The blob is allocated from heap; the caller frees it.
+bool asset_cook_shader(heap_t* heap, const void* vertex_shader, size_t vertex_shader_size, const void* fragment_shader, size_t fragment_shader_size, int uniform_buffer_count, void** blob, size_t* blob_size);
+
+// Point info at the mesh inside a cooked blob. Nothing is copied; the blob must outlive info.
+// Returns false if the blob is not a cooked mesh of this version.
+bool asset_mesh_load(const void* blob, size_t blob_size, gpu_mesh_info_t* info);
+
+// Point info at the shaders inside a cooked blob. Nothing is copied; the blob must outlive info.
+// Returns false if the blob is not a cooked shader of this version.
+bool asset_shader_load(const void* blob, size_t blob_size, gpu_shader_info_t* info);
+
+// Get the content hash of a cooked mesh or shader blob, or 0 if it is not one.
+uint64_t asset_get_content_hash(const void* blob, size_t blob_size);
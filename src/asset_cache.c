@@ -0,0 +1,327 @@
+#include "asset_cache.h"
+#include "atomic.h"
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "mutex.h"
+#include "l4z/xxhash.h"
+
+#include <string.h>
+
+#define ASSET_CACHE_BUCKETS 1024
+
+// Loaded contents, shared by every entry whose file hashed the same.
+typedef struct asset_cache_blob_t
+{
+	struct asset_cache_blob_t* next;
+	uint64_t content_hash;
+	size_t size;
+	fs_work_t* work;
+	int entry_count;
+} asset_cache_blob_t;
+
+typedef struct asset_cache_entry_t
+{
+	asset_cache_t* cache;
+	struct asset_cache_entry_t* next;
+	struct asset_cache_entry_t* lru_prev;
+	struct asset_cache_entry_t* lru_next;
+	uint64_t path_hash;
+	// The read for this path. Once loaded it becomes the blob's work, unless the contents
+	// matched a blob that already existed. The duplicate is then kept until the entry is next
+	// unused, since other holders may still be waiting on it.
+	fs_work_t* work;
+	asset_cache_blob_t* blob;
+	int result;
+	int refs;
+	int loaded;
+	char path[1024];
+} asset_cache_entry_t;
+
+typedef struct asset_cache_t
+{
+	heap_t* heap;
+	fs_t* fs;
+	mutex_t* mutex;
+	size_t budget;
+	size_t resident_size;
+	asset_cache_entry_t* entries[ASSET_CACHE_BUCKETS];
+	asset_cache_blob_t* blobs[ASSET_CACHE_BUCKETS];
+	// Entries nobody holds, least recently used first.
+	asset_cache_entry_t* lru_head;
+	asset_cache_entry_t* lru_tail;
+} asset_cache_t;
+
+asset_cache_t* asset_cache_create(heap_t* heap, fs_t* fs, size_t budget)
+{
+	asset_cache_t* cache = heap_alloc(heap, sizeof(asset_cache_t), 8);
+	memset(cache, 0, sizeof(*cache));
+	cache->heap = heap;
+	cache->fs = fs;
+	cache->mutex = mutex_create();
+	cache->budget = budget;
+	return cache;
+}
+
+void asset_cache_destroy(asset_cache_t* cache)
+{
+	for (int i = 0; i < ASSET_CACHE_BUCKETS; ++i)
+	{
+		asset_cache_entry_t* entry = cache->entries[i];
+		while (entry)
+		{
+			asset_cache_entry_t* next = entry->next;
+			if (entry->refs > 0)
+			{
+				debug_print(k_print_warning, "Asset cache: '%s' is still referenced\n", entry->path);
+			}
+			if (!entry->blob || entry->work != entry->blob->work)
+			{
+				fs_work_destroy(entry->work);
+			}
+			heap_free(cache->heap, entry);
+			entry = next;
+		}
+	}
+	for (int i = 0; i < ASSET_CACHE_BUCKETS; ++i)
+	{
+		asset_cache_blob_t* blob = cache->blobs[i];
+		while (blob)
+		{
+			asset_cache_blob_t* next = blob->next;
+			fs_work_destroy(blob->work);
+			heap_free(cache->heap, blob);
+			blob = next;
+		}
+	}
+	mutex_destroy(cache->mutex);
+	heap_free(cache->heap, cache);
+}
+
+static void asset_cache_lru_remove(asset_cache_t* cache, asset_cache_entry_t* entry)
+{
+	if (entry->lru_prev)
+	{
+		entry->lru_prev->lru_next = entry->lru_next;
+	}
+	else
+	{
+		cache->lru_head = entry->lru_next;
+	}
+	if (entry->lru_next)
+	{
+		entry->lru_next->lru_prev = entry->lru_prev;
+	}
+	else
+	{
+		cache->lru_tail = entry->lru_prev;
+	}
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+static void asset_cache_lru_push(asset_cache_t* cache, asset_cache_entry_t* entry)
+{
+	entry->lru_prev = cache->lru_tail;
+	entry->lru_next = NULL;
+	if (cache->lru_tail)
+	{
+		cache->lru_tail->lru_next = entry;
+	}
+	else
+	{
+		cache->lru_head = entry;
+	}
+	cache->lru_tail = entry;
+}
+
+// Remove an unused entry, and its contents if no other entry shares them.
+static void asset_cache_evict(asset_cache_t* cache, asset_cache_entry_t* entry)
+{
+	asset_cache_entry_t** link = &cache->entries[entry->path_hash % ASSET_CACHE_BUCKETS];
+	while (*link != entry)
+	{
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+
+	asset_cache_blob_t* blob = entry->blob;
+	if (!blob)
+	{
+		fs_work_destroy(entry->work);
+	}
+	else if (--blob->entry_count == 0)
+	{
+		asset_cache_blob_t** blob_link = &cache->blobs[blob->content_hash % ASSET_CACHE_BUCKETS];
+		while (*blob_link != blob)
+		{
+			blob_link = &(*blob_link)->next;
+		}
+		*blob_link = blob->next;
+		cache->resident_size -= blob->size;
+		fs_work_destroy(blob->work);
+		heap_free(cache->heap, blob);
+	}
+	heap_free(cache->heap, entry);
+}
+
+static void asset_cache_trim(asset_cache_t* cache)
+{
+	while (cache->resident_size > cache->budget && cache->lru_head)
+	{
+		asset_cache_entry_t* entry = cache->lru_head;
+		asset_cache_lru_remove(cache, entry);
+		asset_cache_evict(cache, entry);
+	}
+}
+
+asset_cache_entry_t* asset_cache_acquire(asset_cache_t* cache, const char* path, bool use_compression)
+{
+	uint64_t path_hash = XXH64(path, strlen(path), 0);
+
+	mutex_lock(cache->mutex);
+	asset_cache_entry_t** bucket = &cache->entries[path_hash % ASSET_CACHE_BUCKETS];
+	asset_cache_entry_t* entry = *bucket;
+	while (entry && (entry->path_hash != path_hash || strcmp(entry->path, path) != 0))
+	{
+		entry = entry->next;
+	}
+
+	if (entry)
+	{
+		if (entry->refs++ == 0)
+		{
+			asset_cache_lru_remove(cache, entry);
+		}
+	}
+	else
+	{
+		entry = heap_alloc(cache->heap, sizeof(asset_cache_entry_t), 8);
+		memset(entry, 0, sizeof(*entry));
+		entry->cache = cache;
+		entry->path_hash = path_hash;
+		entry->refs = 1;
+		strcpy_s(entry->path, sizeof(entry->path), path);
+		entry->work = fs_read(cache->fs, path, cache->heap, true, use_compression);
+		entry->next = *bucket;
+		*bucket = entry;
+	}
+	mutex_unlock(cache->mutex);
+	return entry;
+}
+
+void asset_cache_release(asset_cache_entry_t* entry)
+{
+	// Settle the entry first so an unused entry never has a read in flight.
+	asset_cache_entry_wait(entry);
+
+	asset_cache_t* cache = entry->cache;
+	mutex_lock(cache->mutex);
+	if (--entry->refs == 0)
+	{
+		if (!entry->blob)
+		{
+			// Failures are not cached; the next request tries again.
+			asset_cache_evict(cache, entry);
+		}
+		else
+		{
+			if (entry->work != entry->blob->work)
+			{
+				cache->resident_size -= entry->blob->size;
+				fs_work_destroy(entry->work);
+				entry->work = entry->blob->work;
+			}
+			asset_cache_lru_push(cache, entry);
+			asset_cache_trim(cache);
+		}
+	}
+	mutex_unlock(cache->mutex);
+}
+
+bool asset_cache_entry_is_done(asset_cache_entry_t* entry)
+{
+	return atomic_load_acquire(&entry->loaded) || fs_work_is_done(entry->work);
+}
+
+void asset_cache_entry_wait(asset_cache_entry_t* entry)
+{
+	if (atomic_load_acquire(&entry->loaded))
+	{
+		return;
+	}
+
+	// The read stays alive while any holder is waiting on it, so wait and hash outside the lock.
+	fs_work_t* work = entry->work;
+	int result = fs_work_get_result(work);
+	size_t size = fs_work_get_size(work);
+	uint64_t content_hash = result == 0 ? XXH64(fs_work_get_buffer(work), size, 0) : 0;
+
+	asset_cache_t* cache = entry->cache;
+	mutex_lock(cache->mutex);
+	if (!entry->loaded)
+	{
+		entry->result = result;
+		if (result == 0)
+		{
+			asset_cache_blob_t** bucket = &cache->blobs[content_hash % ASSET_CACHE_BUCKETS];
+			asset_cache_blob_t* blob = *bucket;
+			// The hash only picks candidates; files are shared only if their bytes match.
+			const void* buffer = fs_work_get_buffer(work);
+			while (blob && (blob->content_hash != content_hash || blob->size != size ||
+				(size > 0 && memcmp(fs_work_get_buffer(blob->work), buffer, size) != 0)))
+			{
+				blob = blob->next;
+			}
+			if (!blob)
+			{
+				blob = heap_alloc(cache->heap, sizeof(asset_cache_blob_t), 8);
+				blob->content_hash = content_hash;
+				blob->size = size;
+				blob->work = work;
+				blob->entry_count = 0;
+				blob->next = *bucket;
+				*bucket = blob;
+			}
+			++blob->entry_count;
+			entry->blob = blob;
+			// A duplicate read counts too until it is dropped.
+			cache->resident_size += size;
+		}
+		atomic_store_release(&entry->loaded, 1);
+		asset_cache_trim(cache);
+	}
+	mutex_unlock(cache->mutex);
+}
+
+int asset_cache_entry_get_result(asset_cache_entry_t* entry)
+{
+	asset_cache_entry_wait(entry);
+	return entry->result;
+}
+
+const void* asset_cache_entry_get_buffer(asset_cache_entry_t* entry)
+{
+	asset_cache_entry_wait(entry);
+	return entry->blob ? fs_work_get_buffer(entry->blob->work) : NULL;
+}
+
+size_t asset_cache_entry_get_size(asset_cache_entry_t* entry)
+{
+	asset_cache_entry_wait(entry);
+	return entry->blob ? entry->blob->size : 0;
+}
+
+uint64_t asset_cache_entry_get_content_hash(asset_cache_entry_t* entry)
+{
+	asset_cache_entry_wait(entry);
+	return entry->blob ? entry->blob->content_hash : 0;
+}
+
+size_t asset_cache_get_resident_size(asset_cache_t* cache)
+{
+	mutex_lock(cache->mutex);
+	size_t resident_size = cache->resident_size;
+	mutex_unlock(cache->mutex);
+	return resident_size;
+}
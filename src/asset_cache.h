@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Asset cache
+// Refcounted cache of file contents in front of fs_read.
+//
+// Requests are keyed by path: every request for a path that is loading or loaded shares one
+// fs_read, so a file is read and decompressed once no matter how many systems ask for it.
+// Once loaded, contents are keyed again by their 64-bit xxHash, so identical files under
+// different paths end up sharing one buffer. Files whose hashes match are compared byte for
+// byte before they share, so a collision never swaps contents.
+//
+// Entries nobody holds stay resident in least recently used order and are evicted once the
+// cache is over its memory budget. Entries in use are never evicted, so the cache can be over
+// budget while they are held.
+
+typedef struct asset_cache_t asset_cache_t;
+typedef struct asset_cache_entry_t asset_cache_entry_t;
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+
+// Create a cache that reads through fs and keeps up to budget bytes of unused contents resident.
+asset_cache_t* asset_cache_create(heap_t* heap, fs_t* fs, size_t budget);
+
+// Destroy a cache and everything it holds. Entries must all have been released.
+void asset_cache_destroy(asset_cache_t* cache);
+
+// Get a reference to the contents of a file, starting a read if it is not loading or loaded.
+// use_compression is how the file was written; a path is always read the way it was first requested.
+// Contents are null terminated. Release the entry with asset_cache_release.
+asset_cache_entry_t* asset_cache_acquire(asset_cache_t* cache, const char* path, bool use_compression);
+
+// Drop a reference to an entry. The entry must not be used afterwards.
+// Blocks if the entry is still loading.
+void asset_cache_release(asset_cache_entry_t* entry);
+
+// Check if an entry has finished loading, without blocking.
+bool asset_cache_entry_is_done(asset_cache_entry_t* entry);
+
+// Block until an entry has finished loading.
+void asset_cache_entry_wait(asset_cache_entry_t* entry);
+
+// Get the result of the read; 0 on success. Blocks until the entry has loaded.
+int asset_cache_entry_get_result(asset_cache_entry_t* entry);
+
+// Get the contents. Blocks until the entry has loaded. NULL if the read failed.
+// The buffer is shared and must not be modified.
+const void* asset_cache_entry_get_buffer(asset_cache_entry_t* entry);
+
+// Get the size of the contents, not counting the null terminator. Blocks until the entry has loaded.
+size_t asset_cache_entry_get_size(asset_cache_entry_t* entry);
+
+// Get the xxHash of the contents. Blocks until the entry has loaded. 0 if the read failed.
+uint64_t asset_cache_entry_get_content_hash(asset_cache_entry_t* entry);
+
+// Get the number of bytes of contents currently held by the cache.
+size_t asset_cache_get_resident_size(asset_cache_t* cache);
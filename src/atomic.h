@@ -1,29 +1,340 @@
 #pragma once
 
-// Atomic operations on 32-bit integers.
+// Atomic operations on 32-bit integers, 64-bit integers and pointers.
+//
+// Everything here is a thin inline wrapper over compiler intrinsics so it compiles down to
+// a single instruction (or a short CAS loop where the target lacks one).
+//
+// Ordering:
+//	read-modify-write operations (increment, fetch_add, exchange, compare_and_exchange)
+//	are sequentially consistent and act as full memory barriers.
+//	atomic_load/atomic_store are sequentially consistent.
+//	*_acquire loads: no later read or write may move before the load.
+//	*_release stores: no earlier read or write may move after the store.
+//	*_relaxed accesses: atomic, but no ordering with respect to other memory.
+//
+// On x86/x64 every load already has acquire and every store release semantics in hardware,
+// so acquire/release/relaxed only need to stop the compiler reordering. Other targets fall
+// back to full barriers through interlocked operations.
+
+#include <intrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define ATOMIC_X86 1
+#endif
+
+#if defined(_M_X64) || defined(_M_ARM64)
+#define ATOMIC_NATIVE_64 1
+#endif
+
+//
+// 32-bit integers
+//
 
 //increment a number atomically
 //returns previous value of number
 //performs following operation atomically:
 //	int old_val = *address; (*address)++; return old_value;
-int atomic_increment(int* address);
+static __forceinline int atomic_increment(int* address)
+{
+	return _InterlockedIncrement((volatile long*)address) - 1;
+}
 
 //decrement a number atomically
 //returns previous value of number
 //performs following operation atomically:
 //	int old_val = *address; (*address)--; return old_value;
-int atomic_decrement(int* address);
+static __forceinline int atomic_decrement(int* address)
+{
+	return _InterlockedDecrement((volatile long*)address) + 1;
+}
+
+//add to a number atomically
+//returns previous value of number
+static __forceinline int atomic_fetch_add(int* address, int value)
+{
+	return _InterlockedExchangeAdd((volatile long*)address, value);
+}
+
+//assign a number atomically
+//returns previous value of number
+static __forceinline int atomic_exchange(int* address, int value)
+{
+	return _InterlockedExchange((volatile long*)address, value);
+}
 
 //compare two numbers atomically and assign if equal
 //returns old value of number
 //performs following operation atomically:
 //	int old_value = *address; if (*address == compare) *address = exchange;
-int atomic_compare_and_exchange(int* dest, int compare, int exchange);
+static __forceinline int atomic_compare_and_exchange(int* dest, int compare, int exchange)
+{
+	return _InterlockedCompareExchange((volatile long*)dest, exchange, compare);
+}
+
+//reads integer from address, without ordering
+static __forceinline int atomic_load_relaxed(int* address)
+{
+	return *(volatile int*)address;
+}
+
+//reads integer from address
+//all writes before the atomic_store_release of the value read are visible afterwards
+static __forceinline int atomic_load_acquire(int* address)
+{
+#if defined(ATOMIC_X86)
+	int value = *(volatile int*)address;
+	_ReadWriteBarrier();
+	return value;
+#else
+	return _InterlockedCompareExchange((volatile long*)address, 0, 0);
+#endif
+}
 
 //reads integer from address
-//all writes before last atomic_store to this address are flushed
-int atomic_load(int* address);
+//sequentially consistent with all other atomic_load/atomic_store and read-modify-write operations
+static __forceinline int atomic_load(int* address)
+{
+	return atomic_load_acquire(address);
+}
+
+//writes an integer, without ordering
+static __forceinline void atomic_store_relaxed(int* address, int value)
+{
+	*(volatile int*)address = value;
+}
 
 //writes an integer
-//paired with an atomic_load, can guarantee ordering and visibility
-void atomic_store(int* address, int value);
+//paired with an atomic_load_acquire, makes all earlier writes visible to the reader
+static __forceinline void atomic_store_release(int* address, int value)
+{
+#if defined(ATOMIC_X86)
+	_ReadWriteBarrier();
+	*(volatile int*)address = value;
+#else
+	_InterlockedExchange((volatile long*)address, value);
+#endif
+}
+
+//writes an integer
+//sequentially consistent: a later atomic_load of another address cannot be satisfied before it
+static __forceinline void atomic_store(int* address, int value)
+{
+	_InterlockedExchange((volatile long*)address, value);
+}
+
+//full memory barrier
+static __forceinline void atomic_fence()
+{
+#if defined(ATOMIC_X86)
+	_mm_mfence();
+#else
+	__dmb(_ARM64_BARRIER_ISH);
+#endif
+}
+
+//
+// 64-bit integers
+//
+
+//compare two numbers atomically and assign if equal
+//returns old value of number
+static __forceinline int64_t atomic_compare_and_exchange64(int64_t* dest, int64_t compare, int64_t exchange)
+{
+	return _InterlockedCompareExchange64((volatile __int64*)dest, exchange, compare);
+}
+
+//add to a number atomically
+//returns previous value of number
+static __forceinline int64_t atomic_fetch_add64(int64_t* address, int64_t value)
+{
+#if defined(ATOMIC_NATIVE_64)
+	return _InterlockedExchangeAdd64((volatile __int64*)address, value);
+#else
+	int64_t old_value = *(volatile int64_t*)address;
+	int64_t seen;
+	while ((seen = atomic_compare_and_exchange64(address, old_value, old_value + value)) != old_value)
+	{
+		old_value = seen;
+	}
+	return old_value;
+#endif
+}
+
+//increment a number atomically
+//returns previous value of number
+static __forceinline int64_t atomic_increment64(int64_t* address)
+{
+	return atomic_fetch_add64(address, 1);
+}
+
+//decrement a number atomically
+//returns previous value of number
+static __forceinline int64_t atomic_decrement64(int64_t* address)
+{
+	return atomic_fetch_add64(address, -1);
+}
+
+//assign a number atomically
+//returns previous value of number
+static __forceinline int64_t atomic_exchange64(int64_t* address, int64_t value)
+{
+#if defined(ATOMIC_NATIVE_64)
+	return _InterlockedExchange64((volatile __int64*)address, value);
+#else
+	int64_t old_value = *(volatile int64_t*)address;
+	int64_t seen;
+	while ((seen = atomic_compare_and_exchange64(address, old_value, value)) != old_value)
+	{
+		old_value = seen;
+	}
+	return old_value;
+#endif
+}
+
+//reads 64-bit integer from address, without ordering
+static __forceinline int64_t atomic_load_relaxed64(int64_t* address)
+{
+#if defined(ATOMIC_NATIVE_64)
+	return *(volatile int64_t*)address;
+#else
+	// A 32-bit target cannot read 64 bits in one plain access.
+	return atomic_compare_and_exchange64(address, 0, 0);
+#endif
+}
+
+//reads 64-bit integer from address, see atomic_load_acquire
+static __forceinline int64_t atomic_load_acquire64(int64_t* address)
+{
+#if defined(_M_X64)
+	int64_t value = *(volatile int64_t*)address;
+	_ReadWriteBarrier();
+	return value;
+#else
+	return atomic_compare_and_exchange64(address, 0, 0);
+#endif
+}
+
+//reads 64-bit integer from address, see atomic_load
+static __forceinline int64_t atomic_load64(int64_t* address)
+{
+	return atomic_load_acquire64(address);
+}
+
+//writes a 64-bit integer, without ordering
+static __forceinline void atomic_store_relaxed64(int64_t* address, int64_t value)
+{
+#if defined(ATOMIC_NATIVE_64)
+	*(volatile int64_t*)address = value;
+#else
+	atomic_exchange64(address, value);
+#endif
+}
+
+//writes a 64-bit integer, see atomic_store_release
+static __forceinline void atomic_store_release64(int64_t* address, int64_t value)
+{
+#if defined(_M_X64)
+	_ReadWriteBarrier();
+	*(volatile int64_t*)address = value;
+#else
+	atomic_exchange64(address, value);
+#endif
+}
+
+//writes a 64-bit integer, see atomic_store
+static __forceinline void atomic_store64(int64_t* address, int64_t value)
+{
+	atomic_exchange64(address, value);
+}
+
+//
+// Pointers
+//
+
+//assign a pointer atomically
+//returns previous value of pointer
+static __forceinline void* atomic_exchange_ptr(void** address, void* value)
+{
+	return _InterlockedExchangePointer((void* volatile*)address, value);
+}
+
+//compare two pointers atomically and assign if equal
+//returns old value of pointer
+static __forceinline void* atomic_compare_and_exchange_ptr(void** dest, void* compare, void* exchange)
+{
+	return _InterlockedCompareExchangePointer((void* volatile*)dest, exchange, compare);
+}
+
+//reads pointer from address, without ordering
+static __forceinline void* atomic_load_relaxed_ptr(void** address)
+{
+	return *(void* volatile*)address;
+}
+
+//reads pointer from address, see atomic_load_acquire
+static __forceinline void* atomic_load_acquire_ptr(void** address)
+{
+#if defined(ATOMIC_X86)
+	void* value = *(void* volatile*)address;
+	_ReadWriteBarrier();
+	return value;
+#else
+	return atomic_compare_and_exchange_ptr(address, NULL, NULL);
+#endif
+}
+
+//reads pointer from address, see atomic_load
+static __forceinline void* atomic_load_ptr(void** address)
+{
+	return atomic_load_acquire_ptr(address);
+}
+
+//writes a pointer, without ordering
+static __forceinline void atomic_store_relaxed_ptr(void** address, void* value)
+{
+	*(void* volatile*)address = value;
+}
+
+//writes a pointer, see atomic_store_release
+static __forceinline void atomic_store_release_ptr(void** address, void* value)
+{
+#if defined(ATOMIC_X86)
+	_ReadWriteBarrier();
+	*(void* volatile*)address = value;
+#else
+	atomic_exchange_ptr(address, value);
+#endif
+}
+
+//writes a pointer, see atomic_store
+static __forceinline void atomic_store_ptr(void** address, void* value)
+{
+	atomic_exchange_ptr(address, value);
+}
+
+//
+// 128-bit values, for tagged pointers and other double-width compare-and-swap.
+// Only available on 64-bit targets; 32-bit targets can pack a pointer and tag into 64 bits.
+//
+
+#if defined(ATOMIC_NATIVE_64)
+
+// 16-byte aligned pair of 64-bit words.
+typedef struct __declspec(align(16)) atomic128_t
+{
+	int64_t low;
+	int64_t high;
+} atomic128_t;
+
+//compare two 128-bit values atomically and assign if equal
+//returns true if the exchange happened
+//on return *compare holds the value dest held before the operation
+static __forceinline bool atomic_compare_and_exchange128(atomic128_t* dest, atomic128_t* compare, atomic128_t exchange)
+{
+	return _InterlockedCompareExchange128((volatile __int64*)dest, exchange.high, exchange.low, (__int64*)compare) != 0;
+}
+
+#endif
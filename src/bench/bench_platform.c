@@ -0,0 +1,152 @@
+#include "bench_platform.h"
+
+#include "../debug.h"
+#include "../heap.h"
+#include "../timer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <malloc.h>
+#else
+#include <time.h>
+#endif
+
+// Heap backed by the C runtime; the benchmarks measure the systems on top of it, not the allocator.
+typedef struct heap_t
+{
+	size_t grow_increment;
+} heap_t;
+
+heap_t* heap_create(size_t grow_increment)
+{
+	heap_t* heap = malloc(sizeof(heap_t));
+	heap->grow_increment = grow_increment;
+	return heap;
+}
+
+void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#else
+	void* address = NULL;
+	if (posix_memalign(&address, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+	{
+		return NULL;
+	}
+	return address;
+#endif
+}
+
+void* heap_realloc(heap_t* heap, void* prev, size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+	return _aligned_realloc(prev, size, alignment);
+#else
+	return realloc(prev, size);
+#endif
+}
+
+void heap_free(heap_t* heap, void* address)
+{
+#if defined(_WIN32)
+	_aligned_free(address);
+#else
+	free(address);
+#endif
+}
+
+void heap_destroy(heap_t* heap)
+{
+	free(heap);
+}
+
+static uint32_t s_mask = k_print_warning | k_print_error;
+
+void debug_set_print_mask(uint32_t mask)
+{
+	s_mask = mask;
+}
+
+void debug_print(uint32_t type, _Printf_format_string_ const char* format, ...)
+{
+	if ((s_mask & type) == 0)
+	{
+		return;
+	}
+	// Benchmark results go to stdout; keep diagnostics out of the way on stderr.
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+static uint64_t s_ticks_start = 0;
+
+void timer_startup()
+{
+	s_ticks_start = 0;
+	s_ticks_start = timer_get_ticks();
+}
+
+uint64_t timer_get_ticks()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart - s_ticks_start;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec - s_ticks_start;
+#endif
+}
+
+uint64_t timer_get_ticks_per_second()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+#else
+	return 1000000000ULL;
+#endif
+}
+
+uint64_t timer_ticks_to_us(uint64_t t)
+{
+	return t * 1000000ULL / timer_get_ticks_per_second();
+}
+
+uint32_t timer_ticks_to_ms(uint64_t t)
+{
+	return (uint32_t)(t * 1000ULL / timer_get_ticks_per_second());
+}
+
+double bench_ticks_to_ns(uint64_t ticks)
+{
+	return (double)ticks * 1000000000.0 / (double)timer_get_ticks_per_second();
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+double bench_percentile(double* samples, int count, double percentile)
+{
+	if (count <= 0)
+	{
+		return 0.0;
+	}
+	qsort(samples, count, sizeof(double), compare_doubles);
+	int index = (int)(percentile / 100.0 * (count - 1) + 0.5);
+	return samples[index];
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Minimal platform layer for headless benchmarks.
+// Provides the heap, debug print and timer entry points the engine modules link against,
+// backed by the C runtime so benchmarks build and run without a window, GPU or Win32.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(_MSC_VER)
+// MSVC conveniences used throughout the engine sources.
+#include <string.h>
+#define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#define _Printf_format_string_
+static inline int strcpy_s(char* dest, size_t size, const char* src)
+{
+	size_t length = strlen(src);
+	if (length >= size)
+	{
+		dest[0] = 0;
+		return 1;
+	}
+	memcpy(dest, src, length + 1);
+	return 0;
+}
+#endif
+
+// Convert a tick delta from timer_get_ticks() to nanoseconds.
+double bench_ticks_to_ns(uint64_t ticks);
+
+// Sort samples in place and return the requested percentile (0-100).
+double bench_percentile(double* samples, int count, double percentile);
@@ -0,0 +1,361 @@
+#include "bench_platform.h"
+
+#include "../debug.h"
+#include "../ecs.h"
+#include "../heap.h"
+#include "../timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef ECS_MAX_ENTITIES
+#define ECS_MAX_ENTITIES 512
+#endif
+
+// Headless ECS benchmark.
+// Measures spawn/despawn throughput, query iteration and random component access.
+// Every result is printed to stdout as one JSON object per line so runs can be diffed and plotted.
+//
+// Queries and updates walk every entity slot, so the ECS capacity is part of what is measured.
+// Each binary therefore runs a single scale, ECS_MAX_ENTITIES entities in an ECS of exactly that
+// capacity; the Makefile and project build one binary per scale.
+//
+// usage: ecs_bench_<scale>
+
+enum
+{
+	k_bench_repeats = 9,
+	k_bench_random_lookups = 1 << 20,
+};
+
+typedef struct position_component_t
+{
+	float x, y, z;
+} position_component_t;
+
+typedef struct velocity_component_t
+{
+	float x, y, z;
+} velocity_component_t;
+
+typedef struct health_component_t
+{
+	int hp;
+	int max_hp;
+} health_component_t;
+
+typedef struct tag_component_t
+{
+	uint32_t flags;
+} tag_component_t;
+
+typedef struct payload_component_t
+{
+	char bytes[64];
+} payload_component_t;
+
+typedef struct bench_t
+{
+	heap_t* heap;
+	ecs_t* ecs;
+	int position_type;
+	int velocity_type;
+	int health_type;
+	int tag_type;
+	int payload_type;
+	ecs_entity_ref_t* refs;
+	int ref_count;
+} bench_t;
+
+// Entity layouts applied at spawn time.
+typedef enum layout_t
+{
+	k_layout_dense,       // every entity has every component
+	k_layout_interleaved, // every other entity lacks velocity
+	k_layout_holes,       // half of the entities are despawned at random, leaving gaps
+	k_layout_count,
+} layout_t;
+
+static const char* s_layout_names[k_layout_count] = { "dense", "interleaved_50", "holes_50" };
+
+static uint32_t s_rng = 0x9e3779b9;
+
+static uint32_t bench_random()
+{
+	s_rng ^= s_rng << 13;
+	s_rng ^= s_rng >> 17;
+	s_rng ^= s_rng << 5;
+	return s_rng;
+}
+
+static void bench_setup(bench_t* bench, int max_entities)
+{
+	bench->ecs = ecs_create(bench->heap);
+	bench->position_type = ecs_register_component_type(bench->ecs, "position", sizeof(position_component_t), _Alignof(position_component_t));
+	bench->velocity_type = ecs_register_component_type(bench->ecs, "velocity", sizeof(velocity_component_t), _Alignof(velocity_component_t));
+	bench->health_type = ecs_register_component_type(bench->ecs, "health", sizeof(health_component_t), _Alignof(health_component_t));
+	bench->tag_type = ecs_register_component_type(bench->ecs, "tag", sizeof(tag_component_t), _Alignof(tag_component_t));
+	bench->payload_type = ecs_register_component_type(bench->ecs, "payload", sizeof(payload_component_t), _Alignof(payload_component_t));
+	bench->refs = heap_alloc(bench->heap, sizeof(ecs_entity_ref_t) * max_entities, 8);
+	bench->ref_count = 0;
+}
+
+static void bench_teardown(bench_t* bench)
+{
+	heap_free(bench->heap, bench->refs);
+	ecs_destroy(bench->ecs);
+	bench->ecs = NULL;
+}
+
+static uint64_t full_mask(bench_t* bench)
+{
+	return (1ULL << bench->position_type) |
+		(1ULL << bench->velocity_type) |
+		(1ULL << bench->health_type) |
+		(1ULL << bench->tag_type) |
+		(1ULL << bench->payload_type);
+}
+
+static void print_result(const char* bench_name, int entities, const char* mix, const char* layout, int matched, double* samples_ns, int sample_count, double per_item_divisor)
+{
+	double p50 = bench_percentile(samples_ns, sample_count, 50.0);
+	double p90 = bench_percentile(samples_ns, sample_count, 90.0);
+	double min = samples_ns[0];
+	printf("{\"bench\":\"%s\",\"entities\":%d,\"mix\":\"%s\",\"layout\":\"%s\",\"matched\":%d,"
+		"\"samples\":%d,\"min_ns\":%.0f,\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p50_ns_per_item\":%.3f}\n",
+		bench_name, entities, mix, layout, matched, sample_count, min, p50, p90,
+		per_item_divisor > 0.0 ? p50 / per_item_divisor : 0.0);
+	fflush(stdout);
+}
+
+// Spawn count entities in the given layout and commit them with ecs_update.
+// Returns the elapsed ticks for the spawn and commit.
+static uint64_t spawn_entities(bench_t* bench, int count, layout_t layout)
+{
+	uint64_t mask = full_mask(bench);
+	uint64_t tag_bit = 1ULL << bench->tag_type;
+	uint64_t velocity_bit = 1ULL << bench->velocity_type;
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < count; ++i)
+	{
+		// Only every fourth entity is tagged, giving the without-tag query something to skip.
+		uint64_t entity_mask = (i & 3) ? mask & ~tag_bit : mask;
+		if (layout == k_layout_interleaved && (i & 1))
+		{
+			entity_mask &= ~velocity_bit;
+		}
+		bench->refs[i] = ecs_entity_add(bench->ecs, entity_mask);
+	}
+	ecs_update(bench->ecs);
+	uint64_t t1 = timer_get_ticks();
+	bench->ref_count = count;
+
+	for (int i = 0; i < count; ++i)
+	{
+		position_component_t* position = ecs_entity_get_component(bench->ecs, bench->refs[i], bench->position_type, false);
+		position->x = (float)i;
+		position->y = 0.0f;
+		position->z = 0.0f;
+		velocity_component_t* velocity = ecs_entity_get_component(bench->ecs, bench->refs[i], bench->velocity_type, false);
+		velocity->x = 1.0f;
+		velocity->y = 0.5f;
+		velocity->z = 0.25f;
+		health_component_t* health = ecs_entity_get_component(bench->ecs, bench->refs[i], bench->health_type, false);
+		health->hp = 100;
+		health->max_hp = 100;
+	}
+
+	if (layout == k_layout_holes)
+	{
+		// Despawn a random half, compacting the surviving refs to the front.
+		int kept = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (bench_random() & 1)
+			{
+				ecs_entity_remove(bench->ecs, bench->refs[i], false);
+			}
+			else
+			{
+				bench->refs[kept++] = bench->refs[i];
+			}
+		}
+		ecs_update(bench->ecs);
+		bench->ref_count = kept;
+	}
+
+	return t1 - t0;
+}
+
+static uint64_t despawn_entities(bench_t* bench)
+{
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < bench->ref_count; ++i)
+	{
+		ecs_entity_remove(bench->ecs, bench->refs[i], false);
+	}
+	ecs_update(bench->ecs);
+	uint64_t t1 = timer_get_ticks();
+	bench->ref_count = 0;
+	return t1 - t0;
+}
+
+static void bench_spawn_despawn(bench_t* bench, int count)
+{
+	double spawn_ns[k_bench_repeats];
+	double despawn_ns[k_bench_repeats];
+	for (int r = 0; r < k_bench_repeats; ++r)
+	{
+		spawn_ns[r] = bench_ticks_to_ns(spawn_entities(bench, count, k_layout_dense));
+		despawn_ns[r] = bench_ticks_to_ns(despawn_entities(bench));
+	}
+	print_result("spawn", count, "all", "dense", count, spawn_ns, k_bench_repeats, count);
+	print_result("despawn", count, "all", "dense", count, despawn_ns, k_bench_repeats, count);
+}
+
+// Query mixes, from touching a single component up to reading every component.
+typedef enum mix_t
+{
+	k_mix_position,
+	k_mix_position_velocity,
+	k_mix_four,
+	k_mix_position_velocity_without_tag,
+	k_mix_count,
+} mix_t;
+
+static const char* s_mix_names[k_mix_count] = { "position", "position_velocity", "four_components", "position_velocity_without_tag" };
+
+static int run_query(bench_t* bench, mix_t mix)
+{
+	int matched = 0;
+	float dt = 0.016f;
+	switch (mix)
+	{
+		case k_mix_position:
+		{
+			uint64_t mask = 1ULL << bench->position_type;
+			for (ecs_query_t query = ecs_query_create(bench->ecs, mask);
+				ecs_query_is_valid(bench->ecs, &query);
+				ecs_query_next(bench->ecs, &query))
+			{
+				position_component_t* position = ecs_query_get_component(bench->ecs, &query, bench->position_type);
+				position->y += dt;
+				++matched;
+			}
+			break;
+		}
+		case k_mix_position_velocity:
+		case k_mix_position_velocity_without_tag:
+		{
+			uint64_t mask = (1ULL << bench->position_type) | (1ULL << bench->velocity_type);
+			uint64_t without_mask = mix == k_mix_position_velocity_without_tag ? (1ULL << bench->tag_type) : 0;
+			for (ecs_query_t query = ecs_query_create_filtered(bench->ecs, mask, without_mask, 0);
+				ecs_query_is_valid(bench->ecs, &query);
+				ecs_query_next(bench->ecs, &query))
+			{
+				position_component_t* position = ecs_query_get_component(bench->ecs, &query, bench->position_type);
+				velocity_component_t* velocity = ecs_query_get_component(bench->ecs, &query, bench->velocity_type);
+				position->x += velocity->x * dt;
+				position->y += velocity->y * dt;
+				position->z += velocity->z * dt;
+				++matched;
+			}
+			break;
+		}
+		case k_mix_four:
+		{
+			uint64_t mask = (1ULL << bench->position_type) | (1ULL << bench->velocity_type) | (1ULL << bench->health_type) | (1ULL << bench->payload_type);
+			for (ecs_query_t query = ecs_query_create(bench->ecs, mask);
+				ecs_query_is_valid(bench->ecs, &query);
+				ecs_query_next(bench->ecs, &query))
+			{
+				position_component_t* position = ecs_query_get_component(bench->ecs, &query, bench->position_type);
+				velocity_component_t* velocity = ecs_query_get_component(bench->ecs, &query, bench->velocity_type);
+				health_component_t* health = ecs_query_get_component(bench->ecs, &query, bench->health_type);
+				payload_component_t* payload = ecs_query_get_component(bench->ecs, &query, bench->payload_type);
+				position->x += velocity->x * dt;
+				health->hp = health->hp > 0 ? health->hp - 1 : health->max_hp;
+				payload->bytes[0] ^= (char)health->hp;
+				++matched;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+	return matched;
+}
+
+static void bench_queries(bench_t* bench, int count)
+{
+	for (int layout = 0; layout < k_layout_count; ++layout)
+	{
+		spawn_entities(bench, count, layout);
+		for (int mix = 0; mix < k_mix_count; ++mix)
+		{
+			double samples_ns[k_bench_repeats];
+			int matched = run_query(bench, mix); // warm up caches
+			for (int r = 0; r < k_bench_repeats; ++r)
+			{
+				uint64_t t0 = timer_get_ticks();
+				matched = run_query(bench, mix);
+				samples_ns[r] = bench_ticks_to_ns(timer_get_ticks() - t0);
+			}
+			print_result("query", count, s_mix_names[mix], s_layout_names[layout], matched, samples_ns, k_bench_repeats, matched);
+		}
+		despawn_entities(bench);
+	}
+}
+
+static void bench_random_access(bench_t* bench, int count)
+{
+	spawn_entities(bench, count, k_layout_dense);
+
+	int* order = heap_alloc(bench->heap, sizeof(int) * k_bench_random_lookups, 8);
+	for (int i = 0; i < k_bench_random_lookups; ++i)
+	{
+		order[i] = bench_random() % bench->ref_count;
+	}
+
+	double samples_ns[k_bench_repeats];
+	float sum = 0.0f;
+	for (int r = 0; r < k_bench_repeats; ++r)
+	{
+		uint64_t t0 = timer_get_ticks();
+		for (int i = 0; i < k_bench_random_lookups; ++i)
+		{
+			position_component_t* position = ecs_entity_get_component(bench->ecs, bench->refs[order[i]], bench->position_type, false);
+			sum += position->x;
+		}
+		samples_ns[r] = bench_ticks_to_ns(timer_get_ticks() - t0);
+	}
+	print_result("get_component_random", count, "position", "dense", k_bench_random_lookups, samples_ns, k_bench_repeats, k_bench_random_lookups);
+
+	// Keep the lookups observable so they are not optimized away.
+	if (sum == -1.0f)
+	{
+		debug_print(k_print_info, "%f\n", sum);
+	}
+
+	heap_free(bench->heap, order);
+	despawn_entities(bench);
+}
+
+int main(int argc, const char* argv[])
+{
+	debug_set_print_mask(k_print_warning | k_print_error);
+	timer_startup();
+
+	int count = ECS_MAX_ENTITIES;
+	printf("{\"bench\":\"config\",\"entities\":%d,\"ecs_capacity\":%d,\"repeats\":%d}\n", count, ECS_MAX_ENTITIES, k_bench_repeats);
+
+	bench_t bench = { .heap = heap_create(64 * 1024 * 1024) };
+	bench_setup(&bench, count);
+	bench_spawn_despawn(&bench, count);
+	bench_queries(&bench, count);
+	bench_random_access(&bench, count);
+	bench_teardown(&bench);
+	heap_destroy(bench.heap);
+	return 0;
+}
@@ -0,0 +1,454 @@
+#include "bench_platform.h"
+
+#include "../atomic.h"
+#include "../debug.h"
+#include "../event.h"
+#include "../heap.h"
+#include "../mutex.h"
+#include "../queue.h"
+#include "../semaphore.h"
+#include "../thread.h"
+#include "../timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synchronization microbenchmark.
+// Runs each primitive under 1, 2, 4 ... N threads and reports the per-operation cost.
+// Every thread times its work in small batches so contention spikes show up in the tail
+// percentiles instead of averaging away. Results are printed to stdout as one JSON object
+// per line, like ecs_bench.
+//
+// usage: sync_bench [max_threads]
+
+enum
+{
+	k_bench_max_threads = 64,
+	k_bench_ops_per_thread = 1 << 17,
+	k_bench_batch_size = 256,
+	k_bench_batches = k_bench_ops_per_thread / k_bench_batch_size,
+	k_bench_wake_rounds = 200,
+	k_bench_queue_capacity = 1024,
+	k_bench_cache_line = 64,
+};
+
+// Counter alone on its cache line.
+typedef struct __declspec(align(64)) padded_counter_t
+{
+	int value;
+} padded_counter_t;
+
+// State shared by all threads of one run.
+typedef struct bench_shared_t
+{
+	padded_counter_t counter;
+	// Per-thread counters side by side: every thread writes its own int, but they share
+	// cache lines, so each write steals the line from the others (false sharing).
+	int packed_counters[k_bench_max_threads];
+	// The same per-thread counters, one cache line each.
+	padded_counter_t padded_counters[k_bench_max_threads];
+	mutex_t* mutex;
+	mutex_t* thread_mutexes[k_bench_max_threads];
+	semaphore_t* semaphore;
+	event_t* thread_events[k_bench_max_threads];
+	queue_t* queue;
+	int thread_count;
+} bench_shared_t;
+
+// Performs count operations of a test on behalf of one thread.
+typedef void (*bench_op_func_t)(bench_shared_t* shared, int thread_index, int count);
+
+typedef struct bench_test_t
+{
+	const char* name;
+	bench_op_func_t func;
+	bool needs_pairs; // threads work in producer/consumer pairs
+} bench_test_t;
+
+typedef struct bench_thread_t
+{
+	bench_shared_t* shared;
+	const bench_test_t* test;
+	event_t* start;
+	int index;
+	double* samples_ns;
+	uint64_t start_ticks;
+	uint64_t end_ticks;
+} bench_thread_t;
+
+// Unsynchronized read-modify-write: fast and wrong, the baseline the rest pay for correctness.
+static void op_no_synchronization(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		*(volatile int*)&shared->counter.value = *(volatile int*)&shared->counter.value + 1;
+	}
+}
+
+// Separate atomic load and store: still races, but the compiler cannot cache the counter.
+static void op_atomic_load_store(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		atomic_store_release(&shared->counter.value, atomic_load_acquire(&shared->counter.value) + 1);
+	}
+}
+
+static void op_atomic_increment(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		atomic_increment(&shared->counter.value);
+	}
+}
+
+static void op_atomic_cas_increment(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		int value = atomic_load_relaxed(&shared->counter.value);
+		int prev;
+		while ((prev = atomic_compare_and_exchange(&shared->counter.value, value, value + 1)) != value)
+		{
+			value = prev;
+		}
+	}
+}
+
+static void op_increment_false_sharing(bench_shared_t* shared, int thread_index, int count)
+{
+	volatile int* counter = &shared->packed_counters[thread_index];
+	for (int i = 0; i < count; ++i)
+	{
+		*counter = *counter + 1;
+	}
+}
+
+static void op_increment_padded(bench_shared_t* shared, int thread_index, int count)
+{
+	volatile int* counter = &shared->padded_counters[thread_index].value;
+	for (int i = 0; i < count; ++i)
+	{
+		*counter = *counter + 1;
+	}
+}
+
+static void op_atomic_increment_false_sharing(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		atomic_increment(&shared->packed_counters[thread_index]);
+	}
+}
+
+static void op_atomic_increment_padded(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		atomic_increment(&shared->padded_counters[thread_index].value);
+	}
+}
+
+static void op_mutex_shared(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		mutex_lock(shared->mutex);
+		shared->counter.value++;
+		mutex_unlock(shared->mutex);
+	}
+}
+
+static void op_mutex_uncontended(bench_shared_t* shared, int thread_index, int count)
+{
+	mutex_t* mutex = shared->thread_mutexes[thread_index];
+	for (int i = 0; i < count; ++i)
+	{
+		mutex_lock(mutex);
+		shared->padded_counters[thread_index].value++;
+		mutex_unlock(mutex);
+	}
+}
+
+// Binary semaphore used as a lock.
+static void op_semaphore_shared(bench_shared_t* shared, int thread_index, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		semaphore_aquire(shared->semaphore);
+		shared->counter.value++;
+		semaphore_release(shared->semaphore);
+	}
+}
+
+// Signalling an event no one waits on and polling it: the fs completion path.
+static void op_event_signal_poll(bench_shared_t* shared, int thread_index, int count)
+{
+	event_t* event = shared->thread_events[thread_index];
+	for (int i = 0; i < count; ++i)
+	{
+		event_signal(event);
+		shared->padded_counters[thread_index].value += event_is_raised(event);
+	}
+}
+
+// Even threads produce, odd threads consume the same number of items.
+static void op_queue_transfer(bench_shared_t* shared, int thread_index, int count)
+{
+	if (thread_index & 1)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			shared->padded_counters[thread_index].value += queue_pop(shared->queue) != NULL;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			queue_push(shared->queue, &shared->counter);
+		}
+	}
+}
+
+static const bench_test_t s_tests[] =
+{
+	{ "no_synchronization", op_no_synchronization },
+	{ "atomic_load_store", op_atomic_load_store },
+	{ "atomic_increment", op_atomic_increment },
+	{ "atomic_cas_increment", op_atomic_cas_increment },
+	{ "increment_false_sharing", op_increment_false_sharing },
+	{ "increment_padded", op_increment_padded },
+	{ "atomic_increment_false_sharing", op_atomic_increment_false_sharing },
+	{ "atomic_increment_padded", op_atomic_increment_padded },
+	{ "mutex_shared", op_mutex_shared },
+	{ "mutex_uncontended", op_mutex_uncontended },
+	{ "semaphore_shared", op_semaphore_shared },
+	{ "event_signal_poll", op_event_signal_poll },
+	{ "queue_transfer", op_queue_transfer, true },
+};
+
+static bench_shared_t* bench_shared_create(heap_t* heap, int thread_count)
+{
+	bench_shared_t* shared = heap_alloc(heap, sizeof(bench_shared_t), k_bench_cache_line);
+	memset(shared, 0, sizeof(*shared));
+	shared->thread_count = thread_count;
+	shared->mutex = mutex_create();
+	shared->semaphore = semaphore_create(1, 1);
+	shared->queue = queue_create(heap, k_bench_queue_capacity);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		shared->thread_mutexes[i] = mutex_create();
+		shared->thread_events[i] = event_create();
+	}
+	return shared;
+}
+
+static void bench_shared_destroy(heap_t* heap, bench_shared_t* shared)
+{
+	for (int i = 0; i < shared->thread_count; ++i)
+	{
+		mutex_destroy(shared->thread_mutexes[i]);
+		event_destroy(shared->thread_events[i]);
+	}
+	queue_destroy(shared->queue);
+	semaphore_destroy(shared->semaphore);
+	mutex_destroy(shared->mutex);
+	heap_free(heap, shared);
+}
+
+static int bench_thread_func(void* user)
+{
+	bench_thread_t* thread = user;
+	event_wait(thread->start);
+
+	thread->start_ticks = timer_get_ticks();
+	for (int b = 0; b < k_bench_batches; ++b)
+	{
+		uint64_t t0 = timer_get_ticks();
+		thread->test->func(thread->shared, thread->index, k_bench_batch_size);
+		thread->samples_ns[b] = bench_ticks_to_ns(timer_get_ticks() - t0) / k_bench_batch_size;
+	}
+	thread->end_ticks = timer_get_ticks();
+	return 0;
+}
+
+static void print_result(const char* test_name, int thread_count, double* samples_ns, int sample_count, uint64_t wall_ticks)
+{
+	double total_ops = (double)thread_count * k_bench_ops_per_thread;
+	double wall_ns = bench_ticks_to_ns(wall_ticks);
+	double p50 = bench_percentile(samples_ns, sample_count, 50.0);
+	double p90 = bench_percentile(samples_ns, sample_count, 90.0);
+	double p99 = bench_percentile(samples_ns, sample_count, 99.0);
+	double max = samples_ns[sample_count - 1];
+	printf("{\"bench\":\"%s\",\"threads\":%d,\"ops\":%.0f,\"samples\":%d,"
+		"\"p50_ns_per_op\":%.2f,\"p90_ns_per_op\":%.2f,\"p99_ns_per_op\":%.2f,\"max_ns_per_op\":%.2f,\"mops_per_sec\":%.2f}\n",
+		test_name, thread_count, total_ops, sample_count, p50, p90, p99, max,
+		wall_ns > 0.0 ? total_ops / wall_ns * 1000.0 : 0.0);
+	fflush(stdout);
+}
+
+static void bench_run(heap_t* heap, const bench_test_t* test, int thread_count)
+{
+	bench_shared_t* shared = bench_shared_create(heap, thread_count);
+	event_t* start = event_create();
+	double* samples_ns = heap_alloc(heap, sizeof(double) * k_bench_batches * thread_count, 8);
+
+	bench_thread_t threads[k_bench_max_threads];
+	thread_t* handles[k_bench_max_threads];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		threads[i] = (bench_thread_t)
+		{
+			.shared = shared,
+			.test = test,
+			.start = start,
+			.index = i,
+			.samples_ns = samples_ns + i * k_bench_batches,
+		};
+		handles[i] = thread_create(bench_thread_func, &threads[i]);
+	}
+
+	// Go!
+	event_signal(start);
+
+	uint64_t first_start = UINT64_MAX;
+	uint64_t last_end = 0;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(handles[i]);
+		first_start = threads[i].start_ticks < first_start ? threads[i].start_ticks : first_start;
+		last_end = threads[i].end_ticks > last_end ? threads[i].end_ticks : last_end;
+	}
+
+	print_result(test->name, thread_count, samples_ns, k_bench_batches * thread_count, last_end - first_start);
+
+	heap_free(heap, samples_ns);
+	event_destroy(start);
+	bench_shared_destroy(heap, shared);
+}
+
+typedef struct wake_thread_t
+{
+	event_t** round_events;
+	uint64_t* signal_ticks;
+	int* woken;
+	double* samples_ns;
+} wake_thread_t;
+
+static int wake_thread_func(void* user)
+{
+	wake_thread_t* thread = user;
+	for (int r = 0; r < k_bench_wake_rounds; ++r)
+	{
+		event_wait(thread->round_events[r]);
+		uint64_t now = timer_get_ticks();
+		thread->samples_ns[r] = bench_ticks_to_ns(now - thread->signal_ticks[r]);
+		atomic_increment(&thread->woken[r]);
+	}
+	return 0;
+}
+
+// Latency from event_signal to each sleeping waiter running again.
+static void bench_event_wake(heap_t* heap, int thread_count)
+{
+	event_t* round_events[k_bench_wake_rounds];
+	uint64_t signal_ticks[k_bench_wake_rounds];
+	int woken[k_bench_wake_rounds] = { 0 };
+	for (int r = 0; r < k_bench_wake_rounds; ++r)
+	{
+		round_events[r] = event_create();
+	}
+	double* samples_ns = heap_alloc(heap, sizeof(double) * k_bench_wake_rounds * thread_count, 8);
+
+	wake_thread_t threads[k_bench_max_threads];
+	thread_t* handles[k_bench_max_threads];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		threads[i] = (wake_thread_t)
+		{
+			.round_events = round_events,
+			.signal_ticks = signal_ticks,
+			.woken = woken,
+			.samples_ns = samples_ns + i * k_bench_wake_rounds,
+		};
+		handles[i] = thread_create(wake_thread_func, &threads[i]);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	for (int r = 0; r < k_bench_wake_rounds; ++r)
+	{
+		while (r > 0 && atomic_load(&woken[r - 1]) < thread_count)
+		{
+			thread_sleep(0);
+		}
+		// Give the waiters time to go to sleep, so this measures a real wake-up.
+		thread_sleep(1);
+		// Published by the full barrier in event_signal.
+		signal_ticks[r] = timer_get_ticks();
+		event_signal(round_events[r]);
+	}
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(handles[i]);
+	}
+	uint64_t wall_ticks = timer_get_ticks() - t0;
+
+	int sample_count = k_bench_wake_rounds * thread_count;
+	double p50 = bench_percentile(samples_ns, sample_count, 50.0);
+	double p90 = bench_percentile(samples_ns, sample_count, 90.0);
+	double p99 = bench_percentile(samples_ns, sample_count, 99.0);
+	printf("{\"bench\":\"event_wake_latency\",\"threads\":%d,\"samples\":%d,"
+		"\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p99_ns\":%.0f,\"max_ns\":%.0f,\"wall_ms\":%u}\n",
+		thread_count, sample_count, p50, p90, p99, samples_ns[sample_count - 1], timer_ticks_to_ms(wall_ticks));
+	fflush(stdout);
+
+	heap_free(heap, samples_ns);
+	for (int r = 0; r < k_bench_wake_rounds; ++r)
+	{
+		event_destroy(round_events[r]);
+	}
+}
+
+// 1, 2, 4 ... doubling, always finishing on max_threads itself.
+static int bench_next_thread_count(int thread_count, int max_threads)
+{
+	if (thread_count < max_threads && thread_count * 2 > max_threads)
+	{
+		return max_threads;
+	}
+	return thread_count * 2;
+}
+
+int main(int argc, const char* argv[])
+{
+	debug_set_print_mask(k_print_warning | k_print_error);
+	timer_startup();
+
+	int max_threads = argc > 1 ? atoi(argv[1]) : thread_get_core_count();
+	max_threads = max_threads < 1 ? 1 : max_threads;
+	max_threads = max_threads > k_bench_max_threads ? k_bench_max_threads : max_threads;
+
+	printf("{\"bench\":\"config\",\"cores\":%d,\"max_threads\":%d,\"ops_per_thread\":%d,\"batch_size\":%d}\n",
+		thread_get_core_count(), max_threads, k_bench_ops_per_thread, k_bench_batch_size);
+
+	heap_t* heap = heap_create(16 * 1024 * 1024);
+	for (int i = 0; i < _countof(s_tests); ++i)
+	{
+		for (int thread_count = 1; thread_count <= max_threads; thread_count = bench_next_thread_count(thread_count, max_threads))
+		{
+			if (s_tests[i].needs_pairs && (thread_count & 1))
+			{
+				continue;
+			}
+			bench_run(heap, &s_tests[i], thread_count);
+		}
+	}
+	for (int thread_count = 1; thread_count <= max_threads; thread_count = bench_next_thread_count(thread_count, max_threads))
+	{
+		bench_event_wake(heap, thread_count);
+	}
+	heap_destroy(heap);
+	return 0;
+}
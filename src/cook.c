@@ -0,0 +1,266 @@
+#include "asset.h"
+#include "cook.h"
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "vec3f.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COOK_DICTIONARY_DMER 8
+#define COOK_DICTIONARY_SEGMENT 64
+#define COOK_DICTIONARY_HASH_BITS 20
+
+typedef struct cook_segment_t
+{
+	size_t offset;
+	uint64_t score;
+} cook_segment_t;
+
+static bool cook_write(fs_t* fs, const char* path, void* blob, size_t blob_size)
+{
+	fs_work_t* work = fs_write(fs, path, blob, blob_size, false);
+	bool success = fs_work_get_result(work) == 0;
+	fs_work_destroy(work);
+	if (!success)
+	{
+		debug_print(k_print_error, "Cook: failed to write '%s'\n", path);
+	}
+	return success;
+}
+
+bool cook_cube(heap_t* heap, void** blob, size_t* blob_size)
+{
+	static const vec3f_t cube_positions[] =
+	{
+		{ -1.0f, -1.0f,  1.0f },
+		{  1.0f, -1.0f,  1.0f },
+		{  1.0f,  1.0f,  1.0f },
+		{ -1.0f,  1.0f,  1.0f },
+		{ -1.0f, -1.0f, -1.0f },
+		{  1.0f, -1.0f, -1.0f },
+		{  1.0f,  1.0f, -1.0f },
+		{ -1.0f,  1.0f, -1.0f },
+	};
+	static const vec3f_t cube_colors[] =
+	{
+		{ 0.0f, 1.0f,  1.0f },
+		{ 1.0f, 0.0f,  1.0f },
+		{ 1.0f, 1.0f,  0.0f },
+		{ 1.0f, 0.0f,  0.0f },
+		{ 0.0f, 1.0f,  0.0f },
+		{ 0.0f, 0.0f,  1.0f },
+		{ 1.0f, 1.0f,  1.0f },
+		{ 0.0f, 0.0f,  0.0f },
+	};
+	static const uint32_t cube_indices[] =
+	{
+		0, 1, 2,
+		2, 3, 0,
+		1, 5, 6,
+		6, 2, 1,
+		7, 6, 5,
+		5, 4, 7,
+		4, 0, 3,
+		3, 7, 4,
+		4, 5, 1,
+		1, 0, 4,
+		3, 2, 6,
+		6, 7, 3
+	};
+	asset_mesh_source_t source =
+	{
+		.positions = cube_positions,
+		.colors = cube_colors,
+		.vertex_count = _countof(cube_positions),
+		.indices = cube_indices,
+		.index_count = _countof(cube_indices),
+	};
+
+	return asset_cook_mesh(heap, &source, k_gpu_mesh_layout_tri_p444_c444_i2, blob, blob_size);
+}
+
+bool cook_shader(heap_t* heap, fs_t* fs, const char* vertex_path, const char* fragment_path, int uniform_buffer_count, void** blob, size_t* blob_size)
+{
+	fs_work_t* vertex_work = fs_read(fs, vertex_path, heap, false, false);
+	fs_work_t* fragment_work = fs_read(fs, fragment_path, heap, false, false);
+
+	bool success = false;
+	if (fs_work_get_result(vertex_work) == 0 && fs_work_get_result(fragment_work) == 0)
+	{
+		success = asset_cook_shader(heap,
+			fs_work_get_buffer(vertex_work), fs_work_get_size(vertex_work),
+			fs_work_get_buffer(fragment_work), fs_work_get_size(fragment_work),
+			uniform_buffer_count, blob, blob_size);
+	}
+	else
+	{
+		debug_print(k_print_error, "Cook: failed to read '%s' or '%s'\n", vertex_path, fragment_path);
+	}
+
+	fs_work_destroy(fragment_work);
+	fs_work_destroy(vertex_work);
+	return success;
+}
+
+// Write a blob cooked in memory out to path and free it.
+// Cooked blobs are stored uncompressed: the game maps them with fs_read_mapped, which does not decode.
+static bool cook_save(heap_t* heap, fs_t* fs, bool cooked, void* blob, size_t blob_size, const char* path)
+{
+	if (!cooked)
+	{
+		debug_print(k_print_error, "Cook: failed to cook '%s'\n", path);
+		return false;
+	}
+	bool success = cook_write(fs, path, blob, blob_size);
+	heap_free(heap, blob);
+	return success;
+}
+
+bool cook_assets(heap_t* heap, fs_t* fs)
+{
+	// Fails harmlessly if the directory is already there.
+	CreateDirectory(L"cooked", NULL);
+
+	void* blob = NULL;
+	size_t blob_size = 0;
+	bool cooked = cook_cube(heap, &blob, &blob_size);
+	bool success = cook_save(heap, fs, cooked, blob, blob_size, "cooked/cube.mesh");
+	cooked = cook_shader(heap, fs, "shaders/triangle.vert.spv", "shaders/triangle.frag.spv", 1, &blob, &blob_size);
+	success = cook_save(heap, fs, cooked, blob, blob_size, "cooked/triangle.shader") && success;
+	debug_print(success ? k_print_info : k_print_error, "Cook: %s\n", success ? "done" : "failed");
+	return success;
+}
+
+static uint32_t cook_hash_dmer(const char* data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return (uint32_t)((value * 0x9e3779b97f4a7c15ull) >> (64 - COOK_DICTIONARY_HASH_BITS));
+}
+
+static int cook_compare_segments(const void* a, const void* b)
+{
+	uint64_t score_a = ((const cook_segment_t*)a)->score;
+	uint64_t score_b = ((const cook_segment_t*)b)->score;
+	return (score_a > score_b) - (score_a < score_b);
+}
+
+size_t cook_train_dictionary(heap_t* heap, const void* const* samples, const size_t* sample_sizes, int sample_count, size_t capacity, void** dictionary)
+{
+	size_t total_size = 0;
+	for (int i = 0; i < sample_count; ++i)
+	{
+		total_size += sample_sizes[i];
+	}
+	char* data = heap_alloc(heap, total_size ? total_size : 1, 8);
+	size_t offset = 0;
+	for (int i = 0; i < sample_count; ++i)
+	{
+		memcpy(data + offset, samples[i], sample_sizes[i]);
+		offset += sample_sizes[i];
+	}
+
+	// Everything fits: the samples themselves make the best dictionary.
+	if (total_size <= capacity)
+	{
+		*dictionary = data;
+		return total_size;
+	}
+
+	size_t segment_size = capacity < COOK_DICTIONARY_SEGMENT ? capacity : COOK_DICTIONARY_SEGMENT;
+	if (segment_size < COOK_DICTIONARY_DMER)
+	{
+		heap_free(heap, data);
+		*dictionary = NULL;
+		return 0;
+	}
+
+	// Score each dmer, a short run of bytes, by the number of samples it appears in, so
+	// content shared between files wins over content repeated within one.
+	size_t table_size = (size_t)1 << COOK_DICTIONARY_HASH_BITS;
+	uint32_t* counts = heap_alloc(heap, table_size * sizeof(uint32_t), 8);
+	uint32_t* last_sample = heap_alloc(heap, table_size * sizeof(uint32_t), 8);
+	memset(counts, 0, table_size * sizeof(uint32_t));
+	memset(last_sample, 0, table_size * sizeof(uint32_t));
+	offset = 0;
+	for (int i = 0; i < sample_count; ++i)
+	{
+		for (size_t p = 0; p + COOK_DICTIONARY_DMER <= sample_sizes[i]; ++p)
+		{
+			uint32_t hash = cook_hash_dmer(data + offset + p);
+			if (last_sample[hash] != (uint32_t)i + 1)
+			{
+				last_sample[hash] = (uint32_t)i + 1;
+				++counts[hash];
+			}
+		}
+		offset += sample_sizes[i];
+	}
+
+	// Split the samples into one epoch per segment that fits and take the best segment of
+	// each, so the dictionary covers all of the samples rather than the most repetitive few.
+	size_t epoch_count = capacity / segment_size;
+	size_t epoch_size = total_size / epoch_count;
+	size_t window_dmers = segment_size - COOK_DICTIONARY_DMER + 1;
+	cook_segment_t* segments = heap_alloc(heap, epoch_count * sizeof(cook_segment_t), 8);
+	size_t segment_count = 0;
+	for (size_t epoch = 0; epoch < epoch_count; ++epoch)
+	{
+		size_t begin = epoch * epoch_size;
+		size_t end = epoch + 1 == epoch_count ? total_size : begin + epoch_size;
+
+		// Slide a segment over the epoch, keeping a running total of its dmer scores.
+		uint64_t score = 0;
+		uint64_t best_score = 0;
+		size_t best_offset = begin;
+		for (size_t p = begin; p + COOK_DICTIONARY_DMER <= end; ++p)
+		{
+			score += counts[cook_hash_dmer(data + p)];
+			if (p >= begin + window_dmers)
+			{
+				score -= counts[cook_hash_dmer(data + p - window_dmers)];
+			}
+			if (p + 1 >= begin + window_dmers && score > best_score)
+			{
+				best_score = score;
+				best_offset = p + 1 - window_dmers;
+			}
+		}
+
+		// A segment made only of dmers seen in a single sample does not help other files.
+		if (best_score <= window_dmers)
+		{
+			continue;
+		}
+		segments[segment_count].offset = best_offset;
+		segments[segment_count].score = best_score;
+		++segment_count;
+
+		// Content already in the dictionary is worth nothing the second time.
+		for (size_t p = best_offset; p < best_offset + window_dmers; ++p)
+		{
+			counts[cook_hash_dmer(data + p)] = 0;
+		}
+	}
+
+	// Best segments go last, where matches against them have the shortest offsets and
+	// where they survive if the dictionary is ever cut to its tail.
+	qsort(segments, segment_count, sizeof(cook_segment_t), cook_compare_segments);
+	size_t size = segment_count * segment_size;
+	char* result = heap_alloc(heap, size ? size : 1, 8);
+	for (size_t i = 0; i < segment_count; ++i)
+	{
+		memcpy(result + i * segment_size, data + segments[i].offset, segment_size);
+	}
+
+	heap_free(heap, segments);
+	heap_free(heap, last_sample);
+	heap_free(heap, counts);
+	heap_free(heap, data);
+	*dictionary = result;
+	return size;
+}
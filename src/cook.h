@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Asset cooker
+// Offline step that turns the game's source assets into load-ready blobs under cooked/ (see asset.h).
+// Run "ga2022 --cook" from the source directory after changing a source asset.
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+
+// Cook every asset the game loads.
+// Returns false if any asset failed to cook.
+bool cook_assets(heap_t* heap, fs_t* fs);
+
+// Cook the game's cube mesh in memory. The blob is allocated from heap; the caller frees it.
+bool cook_cube(heap_t* heap, void** blob, size_t* blob_size);
+
+// Cook a shader pair in memory from its compiled SPIR-V files.
+// The blob is allocated from heap; the caller frees it.
+// Returns false if either file cannot be read.
+bool cook_shader(heap_t* heap, fs_t* fs, const char* vertex_path, const char* fragment_path, int uniform_buffer_count, void** blob, size_t* blob_size);
+
+// Train a dictionary for fs_add_dictionary from samples of the files it will compress.
+// A library function for tools that write compressed files; cook_assets itself does not compress.
+// Picks the stretches of bytes that recur across the most samples, spread over all of them.
+// Dictionaries pay off for many small files of the same kind; keep capacity at 64KB or less,
+// since that is all LZ4 uses. The dictionary is allocated from heap; the caller frees it.
+// Returns its size, which may be less than capacity.
+size_t cook_train_dictionary(heap_t* heap, const void* const* samples, const size_t* sample_sizes, int sample_count, size_t capacity, void** dictionary);
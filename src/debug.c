@@ -1,5 +1,6 @@
 #include "debug.h"
 #include "mutex.h"
+#include "thread.h"
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -27,7 +28,7 @@ typedef struct debug_system_t
 
 static LONG debug_exception_handler(LPEXCEPTION_POINTERS ExceptionInfo)
 {
-	debug_print(k_print_error, "caught exception!\n");
+	debug_print(k_print_error, "caught exception on thread '%s' (%u)!\n", thread_get_name(), GetCurrentThreadId());
 	HANDLE file = CreateFile(L"ga2022-crash.dmp", GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (file != INVALID_HANDLE_VALUE)
 	{
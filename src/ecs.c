@@ -5,10 +5,15 @@
 
 #include <string.h>
 
+// Entity capacity can be raised at build time, e.g. by the ECS benchmark.
+#ifndef ECS_MAX_ENTITIES
+#define ECS_MAX_ENTITIES 512
+#endif
+
 enum
 {
 	k_max_component_types = 64,
-	k_max_entities = 512,
+	k_max_entities = ECS_MAX_ENTITIES,
 };
 
 typedef enum entity_state_t
@@ -23,11 +28,17 @@ typedef struct ecs_t
 {
 	heap_t* heap;
 	int global_sequence;
+	int first_free_entity;
 
 	int sequences[k_max_entities];
 	entity_state_t entity_states[k_max_entities];
 	uint64_t component_masks[k_max_entities];
 
+	int singleton_entities[k_max_component_types];
+	// Component types known to have no active entity, so lookups for them skip the scan.
+	// Cleared for an entity's components when it becomes active.
+	uint64_t singleton_misses;
+
 	void* components[k_max_component_types];
 	size_t component_type_sizes[k_max_component_types];
 	char component_type_names[k_max_component_types][32];
@@ -38,9 +49,12 @@ ecs_t* ecs_create(heap_t* heap)
 	ecs_t* ecs = heap_alloc(heap, sizeof(ecs_t), 8);
 	ecs->heap = heap;
 	ecs->global_sequence = 0;
+	ecs->first_free_entity = 0;
+	ecs->singleton_misses = 0;
 	for (int i = 0; i < _countof(ecs->components); ++i)
 	{
 		ecs->components[i] = NULL;
+		ecs->singleton_entities[i] = -1;
 	}
 	for (int i = 0; i < _countof(ecs->entity_states); ++i)
 	{
@@ -72,10 +86,15 @@ void ecs_update(ecs_t* ecs)
 		if (ecs->entity_states[i] == k_entity_pending_add)
 		{
 			ecs->entity_states[i] = k_entity_active;
+			ecs->singleton_misses &= ~ecs->component_masks[i];
 		}
 		else if (ecs->entity_states[i] == k_entity_pending_remove)
 		{
 			ecs->entity_states[i] = k_entity_unused;
+			if (i < ecs->first_free_entity)
+			{
+				ecs->first_free_entity = i;
+			}
 		}
 	}
 }
@@ -100,16 +119,19 @@ int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_co
 
 ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, uint64_t component_mask)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	// Every slot below first_free_entity is in use, so skip straight past them.
+	for (int i = ecs->first_free_entity; i < _countof(ecs->entity_states); ++i)
 	{
 		if (ecs->entity_states[i] == k_entity_unused)
 		{
+			ecs->first_free_entity = i + 1;
 			ecs->entity_states[i] = k_entity_pending_add;
 			ecs->sequences[i] = ecs->global_sequence++;
 			ecs->component_masks[i] = component_mask;
 			return (ecs_entity_ref_t) { .entity = i, .sequence = ecs->sequences[i] };
 		}
 	}
+	ecs->first_free_entity = _countof(ecs->entity_states);
 	debug_print(k_print_warning, "Out of entities.");
 	return (ecs_entity_ref_t) { .entity = -1, .sequence = -1 };
 }
@@ -145,7 +167,19 @@ void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_t
 
 ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask)
 {
-	ecs_query_t query = { .component_mask = mask, .entity = -1 };
+	return ecs_query_create_filtered(ecs, mask, 0, 0);
+}
+
+ecs_query_t ecs_query_create_filtered(ecs_t* ecs, uint64_t mask, uint64_t without_mask, uint64_t optional_mask)
+{
+	ecs_query_t query =
+	{
+		.component_mask = mask,
+		.without_mask = without_mask,
+		.optional_mask = optional_mask,
+		.entity_mask = 0,
+		.entity = -1,
+	};
 	ecs_query_next(ecs, &query);
 	return query;
 }
@@ -159,17 +193,27 @@ void ecs_query_next(ecs_t* ecs, ecs_query_t* query)
 {
 	for (int i = query->entity + 1; i < _countof(ecs->component_masks); ++i)
 	{
-		if ((ecs->component_masks[i] & query->component_mask) == query->component_mask && ecs->entity_states[i] >= k_entity_active)
+		uint64_t entity_mask = ecs->component_masks[i];
+		if ((entity_mask & query->component_mask) == query->component_mask &&
+			(entity_mask & query->without_mask) == 0 &&
+			ecs->entity_states[i] >= k_entity_active)
 		{
 			query->entity = i;
+			query->entity_mask = entity_mask;
 			return;
 		}
 	}
 	query->entity = -1;
+	query->entity_mask = 0;
 }
 
 void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type)
 {
+	uint64_t component_bit = 1ULL << component_type;
+	if ((query->optional_mask & component_bit) && !(query->entity_mask & component_bit))
+	{
+		return NULL;
+	}
 	char* components = ecs->components[component_type];
 	return &components[ecs->component_type_sizes[component_type] * query->entity];
 }
@@ -178,3 +222,53 @@ ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query)
 {
 	return (ecs_entity_ref_t) { .entity = query->entity, .sequence = ecs->sequences[query->entity] };
 }
+
+
+ecs_entity_ref_t ecs_singleton_get_entity(ecs_t* ecs, int component_type)
+{
+	uint64_t component_bit = 1ULL << component_type;
+
+	// Fast path: the entity found last time still owns the component.
+	int entity = ecs->singleton_entities[component_type];
+	if (ecs->singleton_misses & component_bit)
+	{
+		// Nothing with the component has become active since the last scan.
+		entity = -1;
+	}
+	else if (entity < 0 ||
+		!(ecs->component_masks[entity] & component_bit) ||
+		ecs->entity_states[entity] < k_entity_active)
+	{
+		entity = -1;
+		for (int i = 0; i < _countof(ecs->component_masks); ++i)
+		{
+			if ((ecs->component_masks[i] & component_bit) && ecs->entity_states[i] >= k_entity_active)
+			{
+				entity = i;
+				break;
+			}
+		}
+		ecs->singleton_entities[component_type] = entity;
+		if (entity < 0)
+		{
+			ecs->singleton_misses |= component_bit;
+		}
+	}
+
+	if (entity < 0)
+	{
+		return (ecs_entity_ref_t) { .entity = -1, .sequence = -1 };
+	}
+	return (ecs_entity_ref_t) { .entity = entity, .sequence = ecs->sequences[entity] };
+}
+
+void* ecs_singleton_get_component(ecs_t* ecs, int component_type)
+{
+	ecs_entity_ref_t ref = ecs_singleton_get_entity(ecs, component_type);
+	if (ref.entity < 0)
+	{
+		return NULL;
+	}
+	char* components = ecs->components[component_type];
+	return &components[ecs->component_type_sizes[component_type] * ref.entity];
+}
@@ -19,9 +19,14 @@ typedef struct ecs_entity_ref_t
 } ecs_entity_ref_t;
 
 // Working data for an active entity query.
+// Entities must have every component in component_mask and none in without_mask.
+// Components in optional_mask may be fetched with ecs_query_get_component and return NULL when absent.
 typedef struct ecs_query_t
 {
 	uint64_t component_mask;
+	uint64_t without_mask;
+	uint64_t optional_mask;
+	uint64_t entity_mask;
 	int entity;
 } ecs_query_t;
 
@@ -56,6 +61,10 @@ void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_t
 // Creates a new entity query by component type mask.
 ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask);
 
+// Creates a new entity query that also excludes entities with any component in without_mask.
+// Components in optional_mask are not required to match but can be fetched from the query.
+ecs_query_t ecs_query_create_filtered(ecs_t* ecs, uint64_t mask, uint64_t without_mask, uint64_t optional_mask);
+
 // Determines if the query points at a valid entity.
 bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query);
 
@@ -63,7 +72,18 @@ bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query);
 void ecs_query_next(ecs_t* ecs, ecs_query_t* query);
 
 // Get data for a component on the entity referenced by the query, if any.
+// Optional components not present on the entity return NULL.
 void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type);
 
 // Get a entity reference for the current query location.
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query);
+
+// Get the entity that owns the only active instance of a component type.
+// Result is cached, so this is cheap to call every frame for things like the camera or the player,
+// including while no such entity exists.
+// An invalid reference is returned if no active entity has the component.
+ecs_entity_ref_t ecs_singleton_get_entity(ecs_t* ecs, int component_type);
+
+// Get data for the only active instance of a component type.
+// NULL is returned if no active entity has the component.
+void* ecs_singleton_get_component(ecs_t* ecs, int component_type);
@@ -1,30 +1,71 @@
 #include "event.h"
 
+#include "atomic.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <malloc.h>
+
+#pragma comment(lib, "Synchronization.lib")
+
+enum
+{
+	k_event_raised = 1,
+	k_event_waiting = 2, // at least one thread may be asleep on the event
+
+	k_event_cache_line = 64,
+};
+
+// Manual-reset event in user space: a single state word that waiters sleep on with
+// WaitOnAddress. Keeping the waiting flag in the same word lets event_signal learn whether
+// anyone needs waking from the exchange itself, without touching the event afterwards; a
+// waiter is free to destroy the event as soon as it sees it raised.
+typedef struct event_t
+{
+	int state;
+} event_t;
 
 event_t* event_create()
 {
-	HANDLE evt = CreateEvent(NULL, TRUE, FALSE, NULL);
-	return (event_t*) evt;
+	event_t* event = _aligned_malloc(sizeof(event_t), k_event_cache_line);
+	event->state = 0;
+	return event;
 }
 
 void event_destroy(event_t* event)
 {
-	CloseHandle(event);
+	_aligned_free(event);
 }
 
 void event_signal(event_t* event)
 {
-	SetEvent(event);
+	if (atomic_exchange(&event->state, k_event_raised) & k_event_waiting)
+	{
+		WakeByAddressAll(&event->state);
+	}
 }
 
 void event_wait(event_t* event)
 {
-	WaitForSingleObject(event, INFINITE);
+	int state = atomic_load_acquire(&event->state);
+	while (!(state & k_event_raised))
+	{
+		if (!(state & k_event_waiting))
+		{
+			int prev = atomic_compare_and_exchange(&event->state, state, state | k_event_waiting);
+			if (prev != state)
+			{
+				state = prev;
+				continue;
+			}
+		}
+		int waiting = k_event_waiting;
+		WaitOnAddress(&event->state, &waiting, sizeof(int), INFINITE);
+		state = atomic_load_acquire(&event->state);
+	}
 }
 
 bool event_is_raised(event_t* event)
 {
-	return WaitForSingleObject(event, 0) == WAIT_OBJECT_0;
+	return (atomic_load_acquire(&event->state) & k_event_raised) != 0;
 }
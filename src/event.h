@@ -2,6 +2,10 @@
 
 #include <stdbool.h>
 
+//Manual-reset event thread synchronization
+//Lives in user space: signalling an event no one waits on and checking whether it is raised
+//are single atomic operations.
+
 //handle to an event
 typedef struct event_t event_t;
 
@@ -19,4 +23,5 @@ void event_signal(event_t* event);
 void event_wait(event_t* event);
 
 //determine if an event is signaled
+//does not block or enter the kernel
 bool event_is_raised(event_t* event);
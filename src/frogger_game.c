@@ -1,3 +1,5 @@
+#include "asset.h"
+#include "cook.h"
 #include "ecs.h"
 #include "fs.h"
 #include "debug.h"
@@ -82,8 +84,12 @@ typedef struct frogger_game_t
 
 	gpu_mesh_info_t cube_mesh;
 	gpu_shader_info_t cube_shader;
-	fs_work_t* vertex_shader_work;
-	fs_work_t* fragment_shader_work;
+	fs_work_t* cube_mesh_work;
+	fs_work_t* cube_shader_work;
+	// Cooked in memory when the files under cooked/ are missing or stale.
+	void* cube_mesh_blob;
+	void* cube_shader_blob;
+	bool resources_loaded;
 }frogger_game_t;
 
 static void load_resources(frogger_game_t* game);
@@ -98,6 +104,7 @@ static void draw_models(frogger_game_t* game);
 frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render)
 {
 	frogger_game_t* game = heap_alloc(heap, sizeof(frogger_game_t), 8);
+	memset(game, 0, sizeof(frogger_game_t));
 	game->heap = heap;
 	game->fs = fs;
 	game->window = window;
@@ -160,57 +167,41 @@ void frogger_game_update(frogger_game_t* game)
 
 static void load_resources(frogger_game_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
-	game->cube_shader = (gpu_shader_info_t)
+	// Cooked blobs are already laid out for the gpu, so loading is just mapping them (see cook.h).
+	game->cube_shader_work = fs_read_mapped(game->fs, "cooked/triangle.shader");
+	game->cube_mesh_work = fs_read_mapped(game->fs, "cooked/cube.mesh");
+	// If a cooked file is missing or stale, cook it in memory instead so the game still runs.
+	bool shader_loaded = asset_shader_load(fs_work_get_buffer(game->cube_shader_work), fs_work_get_size(game->cube_shader_work), &game->cube_shader);
+	if (!shader_loaded)
 	{
-		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
-		.vertex_shader_size = fs_work_get_size(game->vertex_shader_work),
-		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
-		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
-		.uniform_buffer_count = 1,
-	};
-
-	static vec3f_t cube_verts[] =
-	{
-		{ -1.0f, -1.0f,  1.0f }, { 0.0f, 1.0f,  1.0f }, //{pos}, {color}
-		{  1.0f, -1.0f,  1.0f }, { 1.0f, 0.0f,  1.0f },
-		{  1.0f,  1.0f,  1.0f }, { 1.0f, 1.0f,  0.0f },
-		{ -1.0f,  1.0f,  1.0f }, { 1.0f, 0.0f,  0.0f },
-		{ -1.0f, -1.0f, -1.0f }, { 0.0f, 1.0f,  0.0f },
-		{  1.0f, -1.0f, -1.0f }, { 0.0f, 0.0f,  1.0f },
-		{  1.0f,  1.0f, -1.0f }, { 1.0f, 1.0f,  1.0f },
-		{ -1.0f,  1.0f, -1.0f }, { 0.0f, 0.0f,  0.0f },
-	};
-	static uint16_t cube_indices[] =
+		debug_print(k_print_warning, "Failed to load cooked/triangle.shader; cooking it in memory (run with --cook to save it)\n");
+		size_t blob_size;
+		shader_loaded = cook_shader(game->heap, game->fs, "shaders/triangle.vert.spv", "shaders/triangle.frag.spv", 1, &game->cube_shader_blob, &blob_size) &&
+			asset_shader_load(game->cube_shader_blob, blob_size, &game->cube_shader);
+	}
+	bool mesh_loaded = asset_mesh_load(fs_work_get_buffer(game->cube_mesh_work), fs_work_get_size(game->cube_mesh_work), &game->cube_mesh);
+	if (!mesh_loaded)
 	{
-		0, 1, 2,
-		2, 3, 0,
-		1, 5, 6,
-		6, 2, 1,
-		7, 6, 5,
-		5, 4, 7,
-		4, 0, 3,
-		3, 7, 4,
-		4, 5, 1,
-		1, 0, 4,
-		3, 2, 6,
-		6, 7, 3
-	};
-	game->cube_mesh = (gpu_mesh_info_t)
+		debug_print(k_print_warning, "Failed to load cooked/cube.mesh; cooking it in memory (run with --cook to save it)\n");
+		size_t blob_size;
+		mesh_loaded = cook_cube(game->heap, &game->cube_mesh_blob, &blob_size) &&
+			asset_mesh_load(game->cube_mesh_blob, blob_size, &game->cube_mesh);
+	}
+
+	// Without both, the models are never pushed to the render thread.
+	game->resources_loaded = shader_loaded && mesh_loaded;
+	if (!game->resources_loaded)
 	{
-		.layout = k_gpu_mesh_layout_tri_p444_c444_i2,
-		.vertex_data = cube_verts,
-		.vertex_data_size = sizeof(cube_verts),
-		.index_data = cube_indices,
-		.index_data_size = sizeof(cube_indices),
-	};
+		debug_print(k_print_error, "Failed to load the cube; models will not be drawn\n");
+	}
 }
 
 static void unload_resources(frogger_game_t* game)
 {
-	fs_work_destroy(game->fragment_shader_work);
-	fs_work_destroy(game->vertex_shader_work);
+	fs_work_destroy(game->cube_mesh_work);
+	fs_work_destroy(game->cube_shader_work);
+	heap_free(game->heap, game->cube_mesh_blob);
+	heap_free(game->heap, game->cube_shader_blob);
 }
 
 static void spawn_player(frogger_game_t* game, int index, int speed)
@@ -350,6 +341,11 @@ static void update_cars(frogger_game_t* game)
 	float dt = (float) timer_object_get_delta_ms(game->timer) * .001f;
 	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->car_type);
 
+	//the player is looked up once instead of once per car
+	ecs_entity_ref_t player_ref = ecs_singleton_get_entity(game->ecs, game->player_type);
+	transform_component_t* player_transform = ecs_entity_get_component(game->ecs, player_ref, game->transform_type, false);
+	player_component_t* player_comp = ecs_entity_get_component(game->ecs, player_ref, game->player_type, false);
+
 	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask); ecs_query_is_valid(game->ecs, &query); ecs_query_next(game->ecs, &query))
 	{
 		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
@@ -370,51 +366,49 @@ static void update_cars(frogger_game_t* game)
 
 		transform_multiply(&transform_comp->transform, &move);
 		
-		//collision check
-		transform_component_t* player_transform = ecs_entity_get_component(game->ecs, game->player_ent, game->transform_type, true);
-		player_component_t* player_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->player_type, true);
-
-		if (fabs(player_transform->transform.translation.z - transform_comp->transform.translation.z) < car_comp->hitbox_h + player_comp->hitbox_h
-			&& fabs(player_transform->transform.translation.y - transform_comp->transform.translation.y) < car_comp->hitbox_w + player_comp->hitbox_w)
+		//collision check; cars keep moving while there is no player
+		if (player_transform && player_comp)
 		{
-			player_transform->transform = player_comp->respawn_pos;
+			if (fabs(player_transform->transform.translation.z - transform_comp->transform.translation.z) < car_comp->hitbox_h + player_comp->hitbox_h
+				&& fabs(player_transform->transform.translation.y - transform_comp->transform.translation.y) < car_comp->hitbox_w + player_comp->hitbox_w)
+			{
+				player_transform->transform = player_comp->respawn_pos;
+			}
 		}
 	}
 }
 
 static void draw_models(frogger_game_t* game)
 {
-	uint64_t k_camera_query_mask = (1ULL << game->camera_type);
-	for (ecs_query_t camera_query = ecs_query_create(game->ecs, k_camera_query_mask);
-		ecs_query_is_valid(game->ecs, &camera_query);
-		ecs_query_next(game->ecs, &camera_query))
+	camera_component_t* camera_comp = ecs_singleton_get_component(game->ecs, game->camera_type);
+	if (!camera_comp || !game->resources_loaded)
 	{
-		camera_component_t* camera_comp = ecs_query_get_component(game->ecs, &camera_query, game->camera_type);
+		return;
+	}
 
-		uint64_t k_model_query_mask = (1ULL << game->transform_type) | (1ULL << game->model_type) | (1ULL << game->material_type);
-		for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
-			ecs_query_is_valid(game->ecs, &query);
-			ecs_query_next(game->ecs, &query))
-		{
-			transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-			model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
-			material_component_t* material_comp = ecs_query_get_component(game->ecs, &query, game->material_type);
-			ecs_entity_ref_t entity_ref = ecs_query_get_entity(game->ecs, &query);
+	uint64_t k_model_query_mask = (1ULL << game->transform_type) | (1ULL << game->model_type) | (1ULL << game->material_type);
+	for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
+		ecs_query_is_valid(game->ecs, &query);
+		ecs_query_next(game->ecs, &query))
+	{
+		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
+		model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
+		material_component_t* material_comp = ecs_query_get_component(game->ecs, &query, game->material_type);
+		ecs_entity_ref_t entity_ref = ecs_query_get_entity(game->ecs, &query);
 
-			struct
-			{
-				mat4f_t projection;
-				mat4f_t model;
-				mat4f_t view;
-				vec3f_t rgb; 
-			} uniform_data;
-			uniform_data.projection = camera_comp->projection;
-			uniform_data.view = camera_comp->view;
-			uniform_data.rgb = material_comp->rgb;
-			transform_to_matrix(&transform_comp->transform, &uniform_data.model);
-			gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
-
-			render_push_model(game->render, &entity_ref, model_comp->mesh_info, model_comp->shader_info, &uniform_info);
-		}
+		struct
+		{
+			mat4f_t projection;
+			mat4f_t model;
+			mat4f_t view;
+			vec3f_t rgb; 
+		} uniform_data;
+		uniform_data.projection = camera_comp->projection;
+		uniform_data.view = camera_comp->view;
+		uniform_data.rgb = material_comp->rgb;
+		transform_to_matrix(&transform_comp->transform, &uniform_data.model);
+		gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
+
+		render_push_model(game->render, &entity_ref, model_comp->mesh_info, model_comp->shader_info, &uniform_info);
 	}
 }
@@ -1,257 +1,1823 @@
 #include "fs.h"
+#include "atomic.h"
 #include "debug.h"
 #include "heap.h"
+#include "job.h"
 #include "thread.h"
 #include "event.h"
 #include "queue.h"
+#include "mutex.h"
+#include "pack.h"
+#include "semaphore.h"
+#define LZ4_STATIC_LINKING_ONLY
 #include "l4z/lz4.h"
+#define LZ4F_STATIC_LINKING_ONLY
+#include "l4z/lz4frame.h"
+#include "l4z/xxhash.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #define COMPRESS_SIZE_LIMIT 2048
 #define DECOMPRESS_SIZE_LIMIT 8192
+#define FS_MAX_WORKERS 32
+#define FS_DEFAULT_IO_WORKERS 4
+#define FS_WRITE_LANES 64
+// Write-behind data for a path is written once this much has built up.
+#define FS_WRITE_BEHIND_SIZE (1024 * 1024)
+#define FS_DEFAULT_IO_QUEUE_DEPTH 32
+#define FS_MAX_COMPLETION_BATCH 64
+#define FS_FRAME_BLOCK_SIZE LZ4F_max256KB
+// Blocks of one streamed read that may be read but not yet decompressed. The reader waits for
+// a credit before reading on, so a slow decode holds the stream back instead of piling up blocks.
+#define FS_STREAM_BLOCK_CREDITS 4
+// Largest single ReadFile or WriteFile, well inside their 32-bit size.
+#define FS_MAX_IO_CHUNK (64 * 1024 * 1024)
+#define FS_MAX_PACKS 16
+#define FS_MAX_DICTIONARIES 16
+// LZ4 only ever looks back this far, so a longer dictionary is cut to its tail.
+#define FS_DICTIONARY_SIZE (64 * 1024)
+
+// Write-behind data for one path, written as a single write when it is flushed.
+typedef struct fs_write_buffer_t
+{
+	char* data;
+	size_t size;
+	size_t capacity;
+	// Set if a write that replaces the file started the buffer, rather than an append.
+	bool replace;
+	bool atomic;
+	char path[1024];
+} fs_write_buffer_t;
+
+// Writes hash to a lane by path. Each lane hands out tickets in fs_write order and only
+// lets the write holding the current ticket run, so writes to one file land in order while
+// everything else proceeds in parallel. A write that reaches a file thread early is parked
+// on its lane and queued again when the lane reaches its ticket.
+typedef struct fs_write_lane_t
+{
+	int next_ticket;
+	int serving;
+	// Out of turn writes, linked through lane_next. Guarded by write_lane_mutex.
+	fs_work_t* parked;
+	// Write-behind data for a path on this lane, if any. Flushed before any other write to
+	// the lane takes a ticket, so it keeps its place in the order.
+	fs_write_buffer_t* buffer;
+} fs_write_lane_t;
+
+// A mounted pack. Its file stays open, tied to the completion port, for the life of the fs.
+typedef struct fs_pack_t
+{
+	HANDLE file;
+	HANDLE mapping;
+	uint32_t entry_count;
+	pack_entry_t* entries;
+} fs_pack_t;
+
+// A shared compression dictionary. Writes compress against the digested form; reads decode
+// each block against the raw bytes.
+typedef struct fs_dictionary_t
+{
+	uint32_t id;
+	char* data;
+	int size;
+	LZ4F_CDict* cdict;
+} fs_dictionary_t;
+
+// Work waiting for a worker pool, one FIFO per priority. Workers take from the most urgent
+// queue that has anything; ready counts queued items so idle workers can sleep until one arrives.
+typedef struct fs_queue_t
+{
+	queue_t* queues[k_fs_priority_count];
+	semaphore_t* ready;
+	// Items across all priorities, and the most the queues can hold between them. ready is
+	// created with that maximum; a release past it would be dropped and its item never popped.
+	int queued;
+	int capacity;
+} fs_queue_t;
 
 typedef struct fs_t
 {
 	heap_t* heap;
-	queue_t* file_queue;
-	queue_t* compression_queue;
-	thread_t* file_thread;
-	thread_t* compression_thread;
+	fs_queue_t file_queue;
+	fs_queue_t compression_queue;
+	// Bounds in-flight work. Every queue can hold all of it at once, along with every block
+	// the streamed reads among it have credits for, so handing work between the file,
+	// completion and compression workers never blocks.
+	semaphore_t* slots;
+	int queue_capacity;
+	int file_thread_count;
+	int compression_thread_count;
+	thread_t* file_threads[FS_MAX_WORKERS];
+	thread_t* compression_threads[FS_MAX_WORKERS];
+	// Reads and writes are issued as overlapped I/O and reaped in batches from the completion
+	// port, so the file threads only open files and submit; they never wait on the device.
+	HANDLE completion_port;
+	thread_t* completion_thread;
+	// Bounds overlapped operations outstanding on the device.
+	semaphore_t* io_depth;
+	int io_queue_depth;
+	fs_write_lane_t write_lanes[FS_WRITE_LANES];
+	mutex_t* write_buffer_mutex;
+	mutex_t* write_lane_mutex;
+	// Threads in fs_flush; completing writes only wake them when there are any.
+	int flush_waiters;
+	// First failure of a write-behind flush since the last fs_flush.
+	int write_behind_result;
+	// Packs are only ever added. A pack is filled in before pack_count is raised past it,
+	// so lookups need no lock.
+	fs_pack_t packs[FS_MAX_PACKS];
+	int pack_count;
+	mutex_t* pack_mutex;
+	// Added and published the same way as packs.
+	fs_dictionary_t dictionaries[FS_MAX_DICTIONARIES];
+	int dictionary_count;
+	mutex_t* dictionary_mutex;
+	uint64_t allocation_granularity;
+	// Work whose deferred callback is waiting for fs_run_callbacks, most recently completed first.
+	fs_work_t* deferred_callbacks;
 }fs_t;
 
+// Outstanding work plus callbacks still to run. Waiters sleep on the count itself, so a batch
+// costs one wake when it drains rather than one per item.
+typedef struct fs_batch_t
+{
+	fs_t* fs;
+	int pending;
+} fs_batch_t;
+
 typedef enum fs_work_op_t
 {
 	k_fs_work_op_read,
 	k_fs_work_op_write,
+	k_fs_work_op_read_mapped,
+	k_fs_work_op_decode_block,
 }fs_work_op_t;
 
+typedef enum fs_read_stage_t
+{
+	k_fs_read_stage_whole,
+	k_fs_read_stage_frame_header,
+	k_fs_read_stage_frame_blocks,
+	k_fs_read_stage_block,
+}fs_read_stage_t;
+
+typedef struct fs_work_t fs_work_t;
+
+// One block of a streamed LZ4 frame read. Once its read lands, a codec worker decompresses
+// it straight into its slot in the output buffer.
+typedef struct fs_block_t
+{
+	// Must come first: codec workers tell blocks from work items by it.
+	fs_work_op_t op;
+	fs_work_t* work;
+	size_t output_offset;
+	int data_size;
+	bool compressed;
+	char* data;
+} fs_block_t;
+
 typedef struct fs_work_t
 {
-	heap_t* heap;
+	// Must come first, see fs_block_t.
 	fs_work_op_t op;
+	heap_t* heap;
+	fs_t* fs;
+	fs_priority_t priority;
+	// Set by fs_work_cancel; each stage checks it before starting anything new.
+	int cancelled;
+	fs_callback_t callback;
+	void* callback_data;
+	fs_callback_dispatch_t callback_dispatch;
+	job_system_t* callback_jobs;
+	fs_batch_t* batch;
+	fs_work_t* callback_next;
 	char path[1024];	//UTF-8
 //	short path[1024];	//UTF-16
 //	int path[1024];		//UTF-32
 	bool null_terminate;
 	bool use_compression;
+	bool append;
+	bool atomic;
+	// Set once an atomic write's data is down; the file is then flushed and renamed into place.
+	bool committing;
+	// Write-behind flushes have no owner and free themselves once complete.
+	bool detached;
+	int compression_level;
+	uint32_t dictionary_id;
+	// Dictionary a compressed read's blocks decode against, from its frame header.
+	const fs_dictionary_t* dictionary;
 	void* buffer;
 	size_t size;
-	size_t compression_size;
+	// Part of the file a read asked for; a range_length of zero reads to the end.
+	uint64_t range_offset;
+	size_t range_length;
+	// Where the compressed data sits in buffer while it waits to be decompressed in place.
+	size_t compressed_offset;
+	size_t compressed_size;
 	event_t* done;
 	int result;
+	int write_lane;
+	int write_ticket;
+	fs_work_t* lane_next;
+	HANDLE file;
+	OVERLAPPED overlapped;
+	// The transfer being issued. Larger ones than a single call can take go out in chunks,
+	// each issued from the completion of the one before on the same I/O slot.
+	char* io_buffer;
+	size_t io_size;
+	size_t io_done;
+	uint64_t io_offset;
+	// Set when reading an entry of a mounted pack; the file handle then belongs to the pack
+	// and every offset is relative to base_offset.
+	fs_pack_t* pack;
+	uint64_t base_offset;
+	uint64_t file_size;
+	// Start of the mapped view; buffer may point past it.
+	void* view;
+	// Compressed reads start with a small read of the frame header, then read one block at a
+	// time while earlier blocks are decompressed by the codec workers.
+	fs_read_stage_t read_stage;
+	char frame_header[LZ4F_HEADER_SIZE_MAX + LZ4F_BLOCK_HEADER_SIZE];
+	fs_block_t* block;
+	size_t block_size;
+	bool block_checksum;
+	uint64_t block_offset;
+	size_t output_offset;
+	int64_t bytes_decompressed;
+	// Blocks not yet decompressed, plus one until the last block has been read.
+	int pending;
+	// Credits left for reading blocks; -1 while the reader is parked waiting for one, with
+	// the block to read next recorded below for the codec worker that hands the credit back.
+	int block_credits;
+	uint32_t next_block_header;
+	uint64_t next_block_offset;
 } fs_work_t;
 
 static int file_thread_func(void* user);
+static void file_commit(fs_work_t* work, fs_t* fs);
 static int compression_thread_func(void* user);
+static int completion_thread_func(void* user);
+
+static void fs_queue_create(fs_queue_t* queue, heap_t* heap, int capacity)
+{
+	queue->capacity = 0;
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue->queues[i] = queue_create(heap, capacity);
+		queue->capacity += queue_get_capacity(queue->queues[i]);
+	}
+	queue->queued = 0;
+	queue->ready = semaphore_create(0, queue->capacity);
+}
+
+static void fs_queue_destroy(fs_queue_t* queue)
+{
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue_destroy(queue->queues[i]);
+	}
+	semaphore_destroy(queue->ready);
+}
+
+static void fs_queue_push(fs_queue_t* queue, void* item, fs_priority_t priority)
+{
+	queue_push(queue->queues[priority], item);
+	int queued = atomic_increment(&queue->queued);
+	assert(queued < queue->capacity);
+	(void)queued;
+	semaphore_release(queue->ready);
+}
+
+static void* fs_queue_pop(fs_queue_t* queue)
+{
+	// Every count on ready was released after its item was pushed, so an item is waiting.
+	semaphore_aquire(queue->ready);
+	atomic_decrement(&queue->queued);
+	while (1)
+	{
+		for (int i = 0; i < k_fs_priority_count; ++i)
+		{
+			void* item;
+			if (queue_try_pop(queue->queues[i], &item))
+			{
+				return item;
+			}
+		}
+	}
+}
+
+static int fs_clamp_worker_count(int count)
+{
+	if (count < 1)
+	{
+		return 1;
+	}
+	return count > FS_MAX_WORKERS ? FS_MAX_WORKERS : count;
+}
+
+fs_t* fs_create(heap_t* heap, int queue_capacity)
+{
+	fs_options_t options = { .queue_capacity = queue_capacity };
+	return fs_create_with_options(heap, &options);
+}
+
+fs_t* fs_create_with_options(heap_t* heap, const fs_options_t* options)
+{
+	int io_worker_count = options->io_worker_count > 0 ? options->io_worker_count : FS_DEFAULT_IO_WORKERS;
+	int codec_worker_count = options->codec_worker_count;
+	if (codec_worker_count <= 0)
+	{
+		int cores = 0;
+		for (uint64_t mask = thread_get_worker_core_mask(); mask; mask &= mask - 1)
+		{
+			++cores;
+		}
+		codec_worker_count = cores > 0 ? cores / 2 : thread_get_core_count() / 2;
+	}
+
+	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
+	memset(fs, 0, sizeof(fs_t));
+	fs->heap = heap;
+	fs->queue_capacity = options->queue_capacity > 0 ? options->queue_capacity : 1;
+	fs->file_thread_count = fs_clamp_worker_count(io_worker_count);
+	fs->compression_thread_count = fs_clamp_worker_count(codec_worker_count);
+	fs->slots = semaphore_create(fs->queue_capacity, fs->queue_capacity);
+	// Room for every in-flight item plus the shutdown markers.
+	fs_queue_create(&fs->file_queue, heap, fs->queue_capacity + fs->file_thread_count);
+	fs_queue_create(&fs->compression_queue, heap, fs->queue_capacity * (1 + FS_STREAM_BLOCK_CREDITS) + fs->compression_thread_count);
+	fs->io_queue_depth = options->io_queue_depth > 0 ? options->io_queue_depth : FS_DEFAULT_IO_QUEUE_DEPTH;
+	fs->io_depth = semaphore_create(fs->io_queue_depth, fs->io_queue_depth);
+	fs->completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	fs->pack_mutex = mutex_create();
+	fs->dictionary_mutex = mutex_create();
+	fs->write_buffer_mutex = mutex_create();
+	fs->write_lane_mutex = mutex_create();
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	fs->allocation_granularity = system_info.dwAllocationGranularity;
+
+	// File threads mostly sit blocked opening files, so they share the fs core with the completion thread.
+	// Codec threads are CPU bound and spread over the job worker cores.
+	for (int i = 0; i < fs->file_thread_count; ++i)
+	{
+		char name[k_thread_name_max];
+		sprintf_s(name, sizeof(name), "fs file %d", i);
+		thread_options_t thread_options =
+		{
+			.name = name,
+			.affinity_mask = thread_get_dedicated_core_mask(k_thread_core_fs),
+			.priority = k_thread_priority_normal,
+		};
+		fs->file_threads[i] = thread_create_with_options(file_thread_func, fs, &thread_options);
+	}
+	for (int i = 0; i < fs->compression_thread_count; ++i)
+	{
+		char name[k_thread_name_max];
+		sprintf_s(name, sizeof(name), "fs compression %d", i);
+		thread_options_t thread_options =
+		{
+			.name = name,
+			.affinity_mask = thread_get_worker_core_mask(),
+			.priority = k_thread_priority_normal,
+		};
+		fs->compression_threads[i] = thread_create_with_options(compression_thread_func, fs, &thread_options);
+	}
+	thread_options_t completion_options =
+	{
+		.name = "fs completion",
+		.affinity_mask = thread_get_dedicated_core_mask(k_thread_core_fs),
+		.priority = k_thread_priority_normal,
+	};
+	fs->completion_thread = thread_create_with_options(completion_thread_func, fs, &completion_options);
+	return fs;
+}
+
+void fs_destroy(fs_t* fs)
+{
+	fs_flush(fs);
+	// Let outstanding work finish first: a worker told to quit could otherwise strand a
+	// read that still needs decompressing.
+	for (int i = 0; i < fs->queue_capacity; ++i)
+	{
+		semaphore_aquire(fs->slots);
+	}
+	for (int i = 0; i < fs->file_thread_count; ++i)
+	{
+		fs_queue_push(&fs->file_queue, NULL, k_fs_priority_normal);
+	}
+	for (int i = 0; i < fs->compression_thread_count; ++i)
+	{
+		fs_queue_push(&fs->compression_queue, NULL, k_fs_priority_normal);
+	}
+	for (int i = 0; i < fs->file_thread_count; ++i)
+	{
+		thread_destroy(fs->file_threads[i]);
+	}
+	for (int i = 0; i < fs->compression_thread_count; ++i)
+	{
+		thread_destroy(fs->compression_threads[i]);
+	}
+	PostQueuedCompletionStatus(fs->completion_port, 0, 0, NULL);
+	thread_destroy(fs->completion_thread);
+	CloseHandle(fs->completion_port);
+	for (int i = 0; i < fs->pack_count; ++i)
+	{
+		if (fs->packs[i].mapping)
+		{
+			CloseHandle(fs->packs[i].mapping);
+		}
+		CloseHandle(fs->packs[i].file);
+		heap_free(fs->heap, fs->packs[i].entries);
+	}
+	mutex_destroy(fs->pack_mutex);
+	for (int i = 0; i < fs->dictionary_count; ++i)
+	{
+		LZ4F_freeCDict(fs->dictionaries[i].cdict);
+		heap_free(fs->heap, fs->dictionaries[i].data);
+	}
+	mutex_destroy(fs->dictionary_mutex);
+	mutex_destroy(fs->write_buffer_mutex);
+	mutex_destroy(fs->write_lane_mutex);
+	fs_queue_destroy(&fs->file_queue);
+	fs_queue_destroy(&fs->compression_queue);
+	semaphore_destroy(fs->io_depth);
+	semaphore_destroy(fs->slots);
+	heap_free(fs->heap, fs);
+}
+
+bool fs_mount_pack(fs_t* fs, const char* path)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return false;
+	}
+
+	// The table of contents is read through a plain handle; entries are read later through an
+	// overlapped one tied to the completion port.
+	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		debug_print(k_print_error, "Failed to open pack '%s'\n", path);
+		return false;
+	}
+
+	pack_header_t header;
+	LARGE_INTEGER file_size;
+	DWORD bytes_read = 0;
+	bool valid = GetFileSizeEx(handle, &file_size) &&
+		ReadFile(handle, &header, sizeof(header), &bytes_read, NULL) && bytes_read == sizeof(header) &&
+		header.magic == k_pack_magic && header.version == k_pack_version &&
+		sizeof(header) + (uint64_t)header.entry_count * sizeof(pack_entry_t) <= (uint64_t)file_size.QuadPart;
+
+	fs_pack_t pack = { 0 };
+	if (valid)
+	{
+		size_t toc_size = header.entry_count * sizeof(pack_entry_t);
+		pack.entry_count = header.entry_count;
+		pack.entries = heap_alloc(fs->heap, toc_size ? toc_size : 1, 8);
+		valid = ReadFile(handle, pack.entries, (DWORD)toc_size, &bytes_read, NULL) && bytes_read == toc_size;
+		for (uint32_t i = 0; i < pack.entry_count && valid; ++i)
+		{
+			const pack_entry_t* entry = &pack.entries[i];
+			valid = entry->offset + entry->stored_size <= (uint64_t)file_size.QuadPart &&
+				entry->compression <= k_pack_compression_lz4hc &&
+				(i == 0 || pack.entries[i - 1].path_hash < entry->path_hash);
+		}
+	}
+	CloseHandle(handle);
+
+	if (valid)
+	{
+		pack.file = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+		valid = pack.file != INVALID_HANDLE_VALUE &&
+			CreateIoCompletionPort(pack.file, fs->completion_port, 0, 0) != NULL;
+	}
+	if (valid && file_size.QuadPart > 0)
+	{
+		pack.mapping = CreateFileMapping(pack.file, NULL, PAGE_READONLY, 0, 0, NULL);
+		valid = pack.mapping != NULL;
+	}
+
+	if (valid)
+	{
+		mutex_lock(fs->pack_mutex);
+		valid = fs->pack_count < FS_MAX_PACKS;
+		if (valid)
+		{
+			fs->packs[fs->pack_count] = pack;
+			atomic_store_release(&fs->pack_count, fs->pack_count + 1);
+		}
+		mutex_unlock(fs->pack_mutex);
+	}
+
+	if (!valid)
+	{
+		debug_print(k_print_error, "Failed to mount pack '%s'\n", path);
+		if (pack.mapping)
+		{
+			CloseHandle(pack.mapping);
+		}
+		if (pack.file && pack.file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(pack.file);
+		}
+		if (pack.entries)
+		{
+			heap_free(fs->heap, pack.entries);
+		}
+	}
+	return valid;
+}
+
+static const fs_dictionary_t* fs_find_dictionary(fs_t* fs, uint32_t id)
+{
+	int count = atomic_load_acquire(&fs->dictionary_count);
+	for (int i = 0; i < count; ++i)
+	{
+		if (fs->dictionaries[i].id == id)
+		{
+			return &fs->dictionaries[i];
+		}
+	}
+	return NULL;
+}
+
+bool fs_add_dictionary(fs_t* fs, unsigned int id, const void* data, size_t size)
+{
+	if (size > FS_DICTIONARY_SIZE)
+	{
+		data = (const char*)data + size - FS_DICTIONARY_SIZE;
+		size = FS_DICTIONARY_SIZE;
+	}
+
+	fs_dictionary_t dictionary = { .id = id, .size = (int)size };
+	dictionary.data = heap_alloc(fs->heap, size ? size : 1, 8);
+	memcpy(dictionary.data, data, size);
+	dictionary.cdict = LZ4F_createCDict(dictionary.data, size);
+
+	mutex_lock(fs->dictionary_mutex);
+	bool valid = id != 0 && dictionary.cdict &&
+		fs->dictionary_count < FS_MAX_DICTIONARIES &&
+		!fs_find_dictionary(fs, id);
+	if (valid)
+	{
+		fs->dictionaries[fs->dictionary_count] = dictionary;
+		atomic_store_release(&fs->dictionary_count, fs->dictionary_count + 1);
+	}
+	mutex_unlock(fs->dictionary_mutex);
+
+	if (!valid)
+	{
+		debug_print(k_print_error, "Failed to add dictionary %u\n", id);
+		LZ4F_freeCDict(dictionary.cdict);
+		heap_free(fs->heap, dictionary.data);
+	}
+	return valid;
+}
+
+static uint32_t fs_hash_path(const char* path)
+{
+	// FNV-1a.
+	uint32_t hash = 2166136261u;
+	for (const char* c = path; *c; ++c)
+	{
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+	}
+	return hash;
+}
+
+static void fs_batch_finish(fs_batch_t* batch)
+{
+	if (batch && atomic_decrement(&batch->pending) == 1)
+	{
+		WakeByAddressAll(&batch->pending);
+	}
+}
+
+// A job_func_t, so job dispatched callbacks can run it directly.
+static void fs_work_run_callback(void* data)
+{
+	fs_work_t* work = data;
+	fs_batch_t* batch = work->batch;
+	// The callback may destroy the work.
+	work->callback(work, work->callback_data);
+	fs_batch_finish(batch);
+}
+
+static void fs_work_defer_callback(fs_t* fs, fs_work_t* work)
+{
+	fs_work_t* head = atomic_load_ptr((void**)&fs->deferred_callbacks);
+	while (1)
+	{
+		work->callback_next = head;
+		fs_work_t* prev = atomic_compare_and_exchange_ptr((void**)&fs->deferred_callbacks, head, work);
+		if (prev == head)
+		{
+			break;
+		}
+		head = prev;
+	}
+}
+
+// Finish a work item, successful or not. Without a callback the work may be destroyed by its
+// owner as soon as done is signalled, so nothing touches it afterwards; with one the work
+// stays alive until the callback has run.
+static void fs_work_notify(fs_t* fs, fs_work_t* work);
+
+static void fs_work_complete(fs_t* fs, fs_work_t* work)
+{
+	if (work->op == k_fs_work_op_write)
+	{
+		// Recorded before the lane moves on, so fs_flush cannot return without seeing it.
+		if (work->detached && work->result != 0)
+		{
+			atomic_compare_and_exchange(&fs->write_behind_result, 0, work->result);
+		}
+		fs_write_lane_t* lane = &fs->write_lanes[work->write_lane];
+		fs_work_t* next = NULL;
+		mutex_lock(fs->write_lane_mutex);
+		int serving = atomic_increment(&lane->serving) + 1;
+		for (fs_work_t** link = &lane->parked; *link; link = &(*link)->lane_next)
+		{
+			if ((*link)->write_ticket == serving)
+			{
+				next = *link;
+				*link = next->lane_next;
+				break;
+			}
+		}
+		mutex_unlock(fs->write_lane_mutex);
+		if (next)
+		{
+			// Popped from the file queue to be parked, so its place there is still free.
+			fs_queue_push(&fs->file_queue, next, next->priority);
+		}
+		if (atomic_load(&fs->flush_waiters))
+		{
+			WakeByAddressAll(&lane->serving);
+		}
+	}
+	semaphore_release(fs->slots);
+
+	if (work->detached)
+	{
+		heap_free(fs->heap, work->buffer);
+		event_destroy(work->done);
+		heap_free(fs->heap, work);
+		return;
+	}
+	fs_work_notify(fs, work);
+}
+
+// Signal a finished work item's owner, then run its callback and finish its batch.
+static void fs_work_notify(fs_t* fs, fs_work_t* work)
+{
+	if (!work->callback)
+	{
+		fs_batch_t* batch = work->batch;
+		event_signal(work->done);
+		fs_batch_finish(batch);
+		return;
+	}
+
+	event_signal(work->done);
+	switch (work->callback_dispatch)
+	{
+		case k_fs_callback_immediate:
+			fs_work_run_callback(work);
+			break;
+		case k_fs_callback_job:
+			job_run(work->callback_jobs, fs_work_run_callback, work, NULL);
+			break;
+		case k_fs_callback_deferred:
+			fs_work_defer_callback(fs, work);
+			break;
+	}
+}
+
+fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
+{
+	fs_read_options_t options =
+	{
+		.null_terminate = null_terminate,
+		.use_compression = use_compression,
+		.priority = k_fs_priority_normal,
+	};
+	return fs_read_with_options(fs, path, heap, &options);
+}
+
+fs_work_t* fs_read_range(fs_t* fs, const char* path, heap_t* heap, uint64_t offset, size_t length)
+{
+	fs_read_options_t options =
+	{
+		.priority = k_fs_priority_normal,
+		.offset = offset,
+		.length = length,
+	};
+	return fs_read_with_options(fs, path, heap, &options);
+}
+
+// Allocate a work item with every field zeroed, then set the ones all work needs.
+static fs_work_t* fs_work_create(fs_t* fs, fs_work_op_t op, const char* path, heap_t* heap)
+{
+	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
+	memset(work, 0, sizeof(fs_work_t));
+	work->op = op;
+	work->heap = heap;
+	work->fs = fs;
+	work->priority = k_fs_priority_normal;
+	// fs_work_cancel may look at the file before a worker has opened it.
+	work->file = INVALID_HANDLE_VALUE;
+	strcpy_s(work->path, sizeof(work->path), path);
+	work->done = event_create();
+	return work;
+}
+
+static void fs_work_set_callback(fs_work_t* work, fs_callback_t callback, void* callback_data, fs_callback_dispatch_t callback_dispatch, job_system_t* callback_jobs, fs_batch_t* batch)
+{
+	work->callback = callback;
+	work->callback_data = callback_data;
+	work->callback_dispatch = callback_dispatch;
+	work->callback_jobs = callback_jobs;
+	work->batch = batch;
+	if (batch)
+	{
+		atomic_increment(&batch->pending);
+	}
+}
+
+fs_work_t* fs_read_with_options(fs_t* fs, const char* path, heap_t* heap, const fs_read_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read, path, heap);
+	work->priority = options->priority;
+	fs_work_set_callback(work, options->callback, options->callback_data, options->callback_dispatch, options->callback_jobs, options->batch);
+	work->null_terminate = options->null_terminate;
+	work->use_compression = options->use_compression;
+	work->range_offset = options->offset;
+	work->range_length = options->length;
+	semaphore_aquire(fs->slots);
+	fs_queue_push(&fs->file_queue, work, work->priority);
+	return work;
+}
+
+fs_work_t* fs_read_mapped(fs_t* fs, const char* path)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_read_mapped, path, fs->heap);
+	semaphore_aquire(fs->slots);
+	fs_queue_push(&fs->file_queue, work, work->priority);
+	return work;
+}
+
+fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
+{
+	fs_write_options_t options =
+	{
+		.use_compression = use_compression,
+	};
+	return fs_write_with_options(fs, path, buffer, size, &options);
+}
+
+static fs_work_t* fs_write_create(fs_t* fs, const char* path, const void* buffer, size_t size, const fs_write_options_t* options)
+{
+	fs_work_t* work = fs_work_create(fs, k_fs_work_op_write, path, fs->heap);
+	fs_work_set_callback(work, options->callback, options->callback_data, options->callback_dispatch, options->callback_jobs, options->batch);
+	work->buffer = (void*)buffer;
+	work->size = size;
+	work->use_compression = options->use_compression;
+	work->append = options->append;
+	work->atomic = options->atomic;
+	work->compression_level = options->compression_level;
+	work->dictionary_id = options->dictionary_id;
+	work->write_lane = fs_hash_path(path) % FS_WRITE_LANES;
+	return work;
+}
+
+// Complete write work that never needed queuing. It holds no slot or ticket, so it skips
+// straight to notifying the owner.
+static fs_work_t* fs_write_complete_now(fs_work_t* work, int result)
+{
+	work->result = result;
+	fs_work_notify(work->fs, work);
+	return work;
+}
+
+static void fs_write_queue(fs_t* fs, fs_work_t* work)
+{
+	semaphore_aquire(fs->slots);
+	work->write_ticket = atomic_increment(&fs->write_lanes[work->write_lane].next_ticket);
+	if(work->use_compression)
+		fs_queue_push(&fs->compression_queue, work, work->priority);
+	else
+		fs_queue_push(&fs->file_queue, work, work->priority);
+}
+
+// Queue a lane's write-behind data as one write. Called with write_buffer_mutex held.
+static void fs_write_buffer_flush(fs_t* fs, fs_write_lane_t* lane)
+{
+	fs_write_buffer_t* buffer = lane->buffer;
+	fs_write_options_t options =
+	{
+		.append = !buffer->replace,
+		.atomic = buffer->atomic,
+	};
+	// The work takes over the data and frees it when done.
+	fs_work_t* work = fs_write_create(fs, buffer->path, buffer->data, buffer->size, &options);
+	work->detached = true;
+	fs_write_queue(fs, work);
+	atomic_store_release_ptr((void**)&lane->buffer, NULL);
+	heap_free(fs->heap, buffer);
+}
+
+static fs_work_t* fs_write_behind(fs_t* fs, fs_work_t* work, const void* data, size_t size)
+{
+	fs_write_lane_t* lane = &fs->write_lanes[work->write_lane];
+	mutex_lock(fs->write_buffer_mutex);
+	fs_write_buffer_t* buffer = lane->buffer;
+	if (buffer && strcmp(buffer->path, work->path) != 0)
+	{
+		fs_write_buffer_flush(fs, lane);
+		buffer = NULL;
+	}
+	if (!buffer)
+	{
+		buffer = heap_alloc(fs->heap, sizeof(fs_write_buffer_t), 8);
+		buffer->capacity = size > FS_WRITE_BEHIND_SIZE ? size : FS_WRITE_BEHIND_SIZE;
+		buffer->data = heap_alloc(fs->heap, buffer->capacity, 8);
+		buffer->size = 0;
+		buffer->replace = false;
+		buffer->atomic = false;
+		strcpy_s(buffer->path, sizeof(buffer->path), work->path);
+		atomic_store_release_ptr((void**)&lane->buffer, buffer);
+	}
+	if (!work->append)
+	{
+		// Whatever was buffered is about to be replaced anyway.
+		buffer->size = 0;
+		buffer->replace = true;
+		buffer->atomic = work->atomic;
+	}
+	if (buffer->size + size > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity * 2 > buffer->size + size ? buffer->capacity * 2 : buffer->size + size;
+		char* grown = heap_alloc(fs->heap, capacity, 8);
+		memcpy(grown, buffer->data, buffer->size);
+		heap_free(fs->heap, buffer->data);
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+	// An atomic replacement is held until fs_flush so the file is replaced in one piece.
+	if (buffer->size >= FS_WRITE_BEHIND_SIZE && !buffer->atomic)
+	{
+		fs_write_buffer_flush(fs, lane);
+	}
+	mutex_unlock(fs->write_buffer_mutex);
+	return fs_write_complete_now(work, 0);
+}
+
+fs_work_t* fs_write_with_options(fs_t* fs, const char* path, const void* buffer, size_t size, const fs_write_options_t* options)
+{
+	fs_work_t* work = fs_write_create(fs, path, buffer, size, options);
+	if (options->append && (options->atomic || options->use_compression))
+	{
+		debug_print(k_print_error, "Cannot append to '%s' %s\n", path, options->atomic ? "atomically" : "with compression");
+		// The caller's buffer is not ours to free in fs_work_destroy.
+		work->buffer = NULL;
+		return fs_write_complete_now(work, -1);
+	}
+	if (options->write_behind && !options->use_compression)
+	{
+		return fs_write_behind(fs, work, buffer, size);
+	}
+
+	fs_write_lane_t* lane = &fs->write_lanes[work->write_lane];
+	if (atomic_load_acquire_ptr((void**)&lane->buffer))
+	{
+		// Write-behind data for the path goes first.
+		mutex_lock(fs->write_buffer_mutex);
+		if (lane->buffer && strcmp(lane->buffer->path, path) == 0)
+		{
+			fs_write_buffer_flush(fs, lane);
+		}
+		fs_write_queue(fs, work);
+		mutex_unlock(fs->write_buffer_mutex);
+		return work;
+	}
+	fs_write_queue(fs, work);
+	return work;
+}
+
+bool fs_flush(fs_t* fs)
+{
+	mutex_lock(fs->write_buffer_mutex);
+	for (int i = 0; i < FS_WRITE_LANES; ++i)
+	{
+		if (fs->write_lanes[i].buffer)
+		{
+			fs_write_buffer_flush(fs, &fs->write_lanes[i]);
+		}
+	}
+	mutex_unlock(fs->write_buffer_mutex);
+
+	// Wait for every ticket handed out so far. Writes queued from here on are not waited for.
+	atomic_increment(&fs->flush_waiters);
+	for (int i = 0; i < FS_WRITE_LANES; ++i)
+	{
+		fs_write_lane_t* lane = &fs->write_lanes[i];
+		int ticket = atomic_load_acquire(&lane->next_ticket);
+		int serving = atomic_load_acquire(&lane->serving);
+		while ((int)((unsigned int)ticket - (unsigned int)serving) > 0)
+		{
+			WaitOnAddress(&lane->serving, &serving, sizeof(int), INFINITE);
+			serving = atomic_load_acquire(&lane->serving);
+		}
+	}
+	atomic_decrement(&fs->flush_waiters);
+	return atomic_exchange(&fs->write_behind_result, 0) == 0;
+}
+bool fs_work_is_done(fs_work_t* work)
+{
+	return work ? event_is_raised(work->done) : true;
+}
+
+void fs_work_wait(fs_work_t* work)
+{
+	if(work)
+		event_wait(work->done);
+}
+
+int fs_work_get_result(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work ? work->result:-1;
+}
+
+void* fs_work_get_buffer(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work ? work->buffer : NULL;
+}
+
+size_t fs_work_get_size(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work ? work->size : 0;
+}
+
+void fs_work_cancel(fs_work_t* work)
+{
+	if (!work || event_is_raised(work->done))
+	{
+		return;
+	}
+	atomic_store_release(&work->cancelled, 1);
+	// An overlapped read on the device is aborted and completes through the port as usual.
+	// Writes are left to finish once started so files are never partially written.
+	if (work->op == k_fs_work_op_read)
+	{
+		CancelIoEx(work->file, &work->overlapped);
+	}
+}
+
+void fs_work_destroy(fs_work_t* work)
+{
+	if (work)
+	{
+		event_wait(work->done);
+		if (work->op == k_fs_work_op_read_mapped)
+		{
+			if (work->view)
+				UnmapViewOfFile(work->view);
+		}
+		else if(work->use_compression || work->op == k_fs_work_op_read)
+			heap_free(work->heap, work->buffer);
+		event_destroy(work->done);
+		heap_free(work->fs->heap, work);
+	}
+}
+
+int fs_run_callbacks(fs_t* fs)
+{
+	fs_work_t* head = atomic_exchange_ptr((void**)&fs->deferred_callbacks, NULL);
+
+	// The list is newest first; flip it so callbacks run in completion order.
+	fs_work_t* ordered = NULL;
+	while (head)
+	{
+		fs_work_t* next = head->callback_next;
+		head->callback_next = ordered;
+		ordered = head;
+		head = next;
+	}
+
+	int count = 0;
+	while (ordered)
+	{
+		fs_work_t* next = ordered->callback_next;
+		fs_work_run_callback(ordered);
+		ordered = next;
+		++count;
+	}
+	return count;
+}
+
+fs_batch_t* fs_batch_create(fs_t* fs)
+{
+	fs_batch_t* batch = heap_alloc(fs->heap, sizeof(fs_batch_t), 8);
+	batch->fs = fs;
+	batch->pending = 0;
+	return batch;
+}
+
+void fs_batch_destroy(fs_batch_t* batch)
+{
+	fs_batch_wait(batch);
+	heap_free(batch->fs->heap, batch);
+}
+
+bool fs_batch_is_done(fs_batch_t* batch)
+{
+	return atomic_load_acquire(&batch->pending) == 0;
+}
+
+void fs_batch_wait(fs_batch_t* batch)
+{
+	int pending = atomic_load_acquire(&batch->pending);
+	while (pending != 0)
+	{
+		WaitOnAddress(&batch->pending, &pending, sizeof(int), INFINITE);
+		pending = atomic_load_acquire(&batch->pending);
+	}
+}
+
+static bool fs_work_is_cancelled(fs_work_t* work)
+{
+	return atomic_load_acquire(&work->cancelled) != 0;
+}
+
+// Complete work dropped by fs_work_cancel before it produced anything.
+static void fs_work_complete_cancelled(fs_t* fs, fs_work_t* work)
+{
+	work->result = ERROR_CANCELLED;
+	work->size = 0;
+	fs_work_complete(fs, work);
+}
+
+// Open a file for overlapped I/O and tie it to the completion port.
+static HANDLE file_open_overlapped(fs_work_t* work, fs_t* fs, const char* path, DWORD access, DWORD share, DWORD disposition, DWORD flags)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		work->result = -1;
+		return INVALID_HANDLE_VALUE;
+	}
+	HANDLE handle = CreateFile(wide_path, access, share, NULL, disposition, flags | FILE_FLAG_OVERLAPPED, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		work->result = GetLastError();
+		return INVALID_HANDLE_VALUE;
+	}
+	if (CreateIoCompletionPort(handle, fs->completion_port, 0, 0) == NULL)
+	{
+		work->result = GetLastError();
+		CloseHandle(handle);
+		return INVALID_HANDLE_VALUE;
+	}
+	return handle;
+}
+
+// Issue the next chunk of the current transfer.
+static bool file_issue_chunk(fs_work_t* work)
+{
+	size_t size = work->io_size - work->io_done;
+	if (size > FS_MAX_IO_CHUNK)
+	{
+		size = FS_MAX_IO_CHUNK;
+	}
+	uint64_t offset = work->base_offset + work->io_offset + work->io_done;
+	void* buffer = work->io_buffer + work->io_done;
+	memset(&work->overlapped, 0, sizeof(work->overlapped));
+	work->overlapped.Offset = (DWORD)offset;
+	work->overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	BOOL issued = work->op == k_fs_work_op_write
+		? WriteFile(work->file, buffer, (DWORD)size, NULL, &work->overlapped)
+		: ReadFile(work->file, buffer, (DWORD)size, NULL, &work->overlapped);
+	if (!issued && GetLastError() != ERROR_IO_PENDING)
+	{
+		work->result = GetLastError();
+		return false;
+	}
+	return true;
+}
+
+// Issue an overlapped read or write on an I/O slot the caller holds. Its completion, synchronous
+// or not, is always delivered through the completion port once the whole transfer is done.
+// Returns false if the operation could not be issued.
+static bool file_issue(fs_work_t* work, void* buffer, size_t size, uint64_t offset)
+{
+	work->io_buffer = buffer;
+	work->io_size = size;
+	work->io_done = 0;
+	work->io_offset = offset;
+	return file_issue_chunk(work);
+}
+
+static bool file_submit(fs_work_t* work, fs_t* fs, void* buffer, size_t size, uint64_t offset)
+{
+	semaphore_aquire(fs->io_depth);
+	if (file_issue(work, buffer, size, offset))
+	{
+		return true;
+	}
+	semaphore_release(fs->io_depth);
+	return false;
+}
+
+static void file_close(fs_work_t* work)
+{
+	if (!work->pack)
+	{
+		CloseHandle(work->file);
+	}
+}
+
+// Close the file and complete the work, successful or not.
+static void file_finish(fs_work_t* work, fs_t* fs)
+{
+	file_close(work);
+	fs_work_complete(fs, work);
+}
+
+// Read the file as stored: all of it, or the range the read asked for, cut off at the end of the file.
+static void file_read_whole(fs_work_t* work)
+{
+	work->read_stage = k_fs_read_stage_whole;
+	if (work->range_offset > work->file_size)
+	{
+		work->range_offset = work->file_size;
+	}
+	uint64_t size = work->file_size - work->range_offset;
+	if (work->range_length != 0 && work->range_length < size)
+	{
+		size = work->range_length;
+	}
+	work->size = (size_t)size;
+	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+}
+
+// Size the buffer so a single LZ4 block of compressed_size bytes can be read into its tail and
+// decompressed in place. LZ4 can decompress over its own input if the input ends the buffer and
+// there is a small margin past the output. Data that did not shrink gets its own region after
+// the output.
+static void file_alloc_in_place(fs_work_t* work)
+{
+	size_t buffer_size = work->compressed_size < work->size
+		? LZ4_DECOMPRESS_INPLACE_BUFFER_SIZE(work->size)
+		: work->size + 1 + work->compressed_size;
+	work->buffer = heap_alloc(work->heap, buffer_size, 8);
+	work->compressed_offset = buffer_size - work->compressed_size;
+	work->read_stage = k_fs_read_stage_block;
+}
+
+static bool fs_work_has_range(fs_work_t* work)
+{
+	return work->range_offset != 0 || work->range_length != 0;
+}
+
+static const pack_entry_t* fs_find_pack_entry(fs_t* fs, const char* path, fs_pack_t** pack)
+{
+	int pack_count = atomic_load_acquire(&fs->pack_count);
+	if (pack_count == 0)
+	{
+		return NULL;
+	}
+	uint64_t path_hash = pack_hash_path(path);
+	// Later packs win, so a patch pack can override entries of the packs mounted before it.
+	for (int i = pack_count - 1; i >= 0; --i)
+	{
+		const pack_entry_t* entry = pack_find_entry(fs->packs[i].entries, fs->packs[i].entry_count, path_hash);
+		if (entry)
+		{
+			*pack = &fs->packs[i];
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// Entries are read with the pack's own handle, so there is nothing to open.
+// Compression is a property of the entry; use_compression does not apply.
+static void file_read_pack_entry(fs_work_t* work, fs_t* fs, fs_pack_t* pack, const pack_entry_t* entry)
+{
+	work->pack = pack;
+	work->file = pack->file;
+	work->base_offset = entry->offset;
+	work->file_size = entry->stored_size;
+	bool submitted;
+	if (entry->compression == k_pack_compression_none)
+	{
+		file_read_whole(work);
+		submitted = file_submit(work, fs, work->buffer, work->size, work->range_offset);
+	}
+	else if (fs_work_has_range(work))
+	{
+		debug_print(k_print_error, "Cannot read a range of compressed pack entry '%s'\n", work->path);
+		work->result = -1;
+		submitted = false;
+	}
+	else
+	{
+		work->size = (size_t)entry->size;
+		work->compressed_size = (size_t)entry->stored_size;
+		file_alloc_in_place(work);
+		submitted = file_submit(work, fs, (char*)work->buffer + work->compressed_offset, work->compressed_size, 0);
+	}
+	if (!submitted)
+	{
+		file_finish(work, fs);
+	}
+}
+
+static void file_read(fs_work_t* work, fs_t* fs)
+{
+	fs_pack_t* pack = NULL;
+	const pack_entry_t* entry = fs_find_pack_entry(fs, work->path, &pack);
+	if (entry)
+	{
+		file_read_pack_entry(work, fs, pack, entry);
+		return;
+	}
+	// Compressed data has to be decoded from the start.
+	if (work->use_compression && fs_work_has_range(work))
+	{
+		debug_print(k_print_error, "Cannot read a range of compressed file '%s'\n", work->path);
+		work->result = -1;
+		fs_work_complete(fs, work);
+		return;
+	}
+
+	work->file = file_open_overlapped(work, fs, work->path, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN);
+	if (work->file == INVALID_HANDLE_VALUE)
+	{
+		fs_work_complete(fs, work);
+		return;
+	}
+
+	if (!GetFileSizeEx(work->file, (PLARGE_INTEGER)&work->file_size))
+	{
+		work->result = GetLastError();
+		file_finish(work, fs);
+		return;
+	}
+
+	if (work->use_compression)
+	{
+		// Read just enough to tell an LZ4 frame from the older size line format.
+		work->read_stage = k_fs_read_stage_frame_header;
+		size_t probe_size = work->file_size < sizeof(work->frame_header) ? (size_t)work->file_size : sizeof(work->frame_header);
+		if (!file_submit(work, fs, work->frame_header, probe_size, 0))
+		{
+			file_finish(work, fs);
+		}
+		return;
+	}
+	file_read_whole(work);
+	if (!file_submit(work, fs, work->buffer, work->size, work->range_offset))
+	{
+		file_finish(work, fs);
+	}
+}
+
+// Drop one reference to a streamed read. Whoever drops the last one, the reader or a codec
+// worker, finishes the work.
+static void fs_stream_release(fs_work_t* work, fs_t* fs)
+{
+	if (atomic_decrement(&work->pending) != 1)
+	{
+		return;
+	}
+	if (work->result == 0 && (uint64_t)work->bytes_decompressed != work->size)
+	{
+		debug_print(k_print_error, "LZ4 frame in '%s' is shorter than its content size\n", work->path);
+		work->result = -1;
+	}
+	if (work->result == 0)
+	{
+		((char*)work->buffer)[work->size] = 0;
+	}
+	else
+	{
+		work->size = 0;
+	}
+	fs_work_complete(fs, work);
+}
+
+static void fs_stream_end(fs_work_t* work, fs_t* fs)
+{
+	file_close(work);
+	fs_stream_release(work, fs);
+}
+
+// Start reading the block described by block_header together with the header of the block after it.
+// Stream reads follow on from the read that just completed and keep its I/O slot. Returns false
+// if no read was issued, in which case the stream has been ended.
+static bool fs_stream_next_block(fs_work_t* work, fs_t* fs, uint32_t block_header, uint64_t offset)
+{
+	if (block_header == 0)
+	{
+		// End mark. An optional content checksum may follow; it is not verified.
+		fs_stream_end(work, fs);
+		return false;
+	}
+	if (fs_work_is_cancelled(work))
+	{
+		work->result = ERROR_CANCELLED;
+		fs_stream_end(work, fs);
+		return false;
+	}
+
+	// High bit set marks a block stored uncompressed.
+	bool compressed = (block_header & 0x80000000u) == 0;
+	size_t data_size = block_header & 0x7fffffffu;
+	size_t read_size = data_size + (work->block_checksum ? 4 : 0) + LZ4F_BLOCK_HEADER_SIZE;
+	if (data_size > work->block_size || offset + read_size > work->file_size)
+	{
+		debug_print(k_print_error, "Corrupt LZ4 frame in '%s'\n", work->path);
+		work->result = -1;
+		fs_stream_end(work, fs);
+		return false;
+	}
 
-fs_t* fs_create(heap_t* heap, int queue_capacity)
-{
-	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
-	fs->heap = heap;
-	fs->file_queue = queue_create(heap, queue_capacity);
-	fs->compression_queue = queue_create(heap, queue_capacity);
-	fs->file_thread = thread_create(file_thread_func, fs);
-	fs->compression_thread = thread_create(compression_thread_func, fs);
-	return fs;
+	fs_block_t* block = heap_alloc(fs->heap, sizeof(fs_block_t) + read_size, 8);
+	block->op = k_fs_work_op_decode_block;
+	block->work = work;
+	block->output_offset = work->output_offset;
+	block->data_size = (int)data_size;
+	block->compressed = compressed;
+	block->data = (char*)(block + 1);
+	work->block = block;
+	work->block_offset = offset;
+	work->output_offset += work->block_size;
+	atomic_increment(&work->pending);
+	if (!file_issue(work, block->data, read_size, offset))
+	{
+		work->block = NULL;
+		heap_free(fs->heap, block);
+		atomic_decrement(&work->pending);
+		fs_stream_end(work, fs);
+		return false;
+	}
+	return true;
 }
 
-void fs_destroy(fs_t* fs)
+// Files written before compressed files became LZ4 frames hold the uncompressed size as a
+// decimal line followed by a single LZ4 block. The probe already read the size line, so only
+// the block is read, into the tail of a buffer sized for decompressing it in place.
+static bool file_read_size_line(fs_work_t* work, fs_t* fs, size_t bytes_read)
 {
-	queue_push(fs->file_queue, NULL);
-	thread_destroy(fs->file_thread);
-	queue_destroy(fs->file_queue);
-	queue_destroy(fs->compression_queue);
-	heap_free(fs->heap, fs);
+	size_t line_length = 0;
+	while (line_length < bytes_read && work->frame_header[line_length] >= '0' && work->frame_header[line_length] <= '9')
+	{
+		++line_length;
+	}
+	if (line_length == 0 || line_length == bytes_read || work->frame_header[line_length] != '\n')
+	{
+		debug_print(k_print_error, "Unrecognized compressed file '%s'\n", work->path);
+		work->result = -1;
+		file_finish(work, fs);
+		return false;
+	}
+	work->frame_header[line_length] = 0;
+	work->size = (size_t)strtoull(work->frame_header, NULL, 10);
+	work->compressed_size = (size_t)work->file_size - line_length - 1;
+	file_alloc_in_place(work);
+	if (!file_issue(work, (char*)work->buffer + work->compressed_offset, work->compressed_size, line_length + 1))
+	{
+		file_finish(work, fs);
+		return false;
+	}
+	return true;
 }
 
-fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
+static bool fs_stream_begin(fs_work_t* work, fs_t* fs, size_t bytes_read)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = heap;
-	work->op = k_fs_work_op_read;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = NULL;
-	work->size = 0;
-	work->done = event_create();
-	work->result = 0;
-	work->null_terminate = null_terminate;
-	work->use_compression = use_compression;
-	queue_push(fs->file_queue, work);
-	return work;
-}
+	uint32_t magic = 0;
+	if (bytes_read >= sizeof(magic))
+	{
+		memcpy(&magic, work->frame_header, sizeof(magic));
+	}
+	if (magic != LZ4F_MAGICNUMBER)
+	{
+		return file_read_size_line(work, fs, bytes_read);
+	}
 
-fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
-{
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = fs->heap;
-	work->op = k_fs_work_op_write;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = (void*)buffer;
-	work->size = size;
-	work->done = event_create();
-	work->result = 0;
-	work->null_terminate = false;
-	work->use_compression = use_compression;
-	if(use_compression)
-		queue_push(fs->compression_queue, work);
-	else
-		queue_push(fs->file_queue, work);
+	LZ4F_frameInfo_t info;
+	size_t header_size = bytes_read;
+	LZ4F_dctx* context = NULL;
+	size_t error = LZ4F_createDecompressionContext(&context, LZ4F_VERSION);
+	if (!LZ4F_isError(error))
+	{
+		error = LZ4F_getFrameInfo(context, &info, work->frame_header, &header_size);
+	}
+	LZ4F_freeDecompressionContext(context);
 
-	return work;
+	// Blocks are decompressed in parallel straight into the output, so they must not refer
+	// back to each other. A frame without a content size decodes as empty and fails below.
+	if (LZ4F_isError(error) || info.blockMode != LZ4F_blockIndependent || header_size + LZ4F_BLOCK_HEADER_SIZE > bytes_read)
+	{
+		debug_print(k_print_error, "Unsupported LZ4 frame in '%s'\n", work->path);
+		work->result = -1;
+		file_finish(work, fs);
+		return false;
+	}
+
+	if (info.dictID)
+	{
+		work->dictionary = fs_find_dictionary(fs, info.dictID);
+		if (!work->dictionary)
+		{
+			debug_print(k_print_error, "'%s' was compressed with dictionary %u, which has not been added\n", work->path, info.dictID);
+			work->result = -1;
+			file_finish(work, fs);
+			return false;
+		}
+	}
+
+	int block_size_id = info.blockSizeID == LZ4F_default ? LZ4F_max64KB : info.blockSizeID;
+	work->block_size = (size_t)1 << (8 + 2 * block_size_id);
+	work->block_checksum = info.blockChecksumFlag == LZ4F_blockChecksumEnabled;
+	work->size = (size_t)info.contentSize;
+	work->buffer = heap_alloc(work->heap, work->size + 1, 8);
+	work->output_offset = 0;
+	work->bytes_decompressed = 0;
+	work->pending = 1;
+	// The first block takes a credit.
+	work->block_credits = FS_STREAM_BLOCK_CREDITS - 1;
+	work->read_stage = k_fs_read_stage_frame_blocks;
 
+	uint32_t block_header;
+	memcpy(&block_header, work->frame_header + header_size, sizeof(block_header));
+	return fs_stream_next_block(work, fs, block_header, header_size + LZ4F_BLOCK_HEADER_SIZE);
 }
 
-bool fs_work_is_done(fs_work_t* work)
+// A block read landed: hand it to the codec workers and move on to the next one.
+static bool fs_stream_block_read(fs_work_t* work, fs_t* fs, size_t bytes_read)
 {
-	return work ? event_is_raised(work->done) : true;
+	fs_block_t* block = work->block;
+	work->block = NULL;
+	size_t header_offset = block->data_size + (work->block_checksum ? 4 : 0);
+	if (bytes_read != header_offset + LZ4F_BLOCK_HEADER_SIZE)
+	{
+		debug_print(k_print_error, "Short read of LZ4 frame in '%s'\n", work->path);
+		heap_free(fs->heap, block);
+		atomic_decrement(&work->pending);
+		work->result = -1;
+		fs_stream_end(work, fs);
+		return false;
+	}
+
+	uint32_t block_header;
+	memcpy(&block_header, block->data + header_offset, sizeof(block_header));
+	uint64_t next_offset = work->block_offset + bytes_read;
+	fs_queue_push(&fs->compression_queue, block, work->priority);
+	if (block_header != 0)
+	{
+		// Recorded before taking the credit, so a worker returning one can carry on from here.
+		work->next_block_header = block_header;
+		work->next_block_offset = next_offset;
+		if (atomic_decrement(&work->block_credits) <= 0)
+		{
+			// Out of credits: give up the I/O slot until a block has been decompressed.
+			return false;
+		}
+	}
+	return fs_stream_next_block(work, fs, block_header, next_offset);
 }
 
-void fs_work_wait(fs_work_t* work)
+// Continue a stream parked for want of a credit, on the codec worker that just returned one.
+static void fs_stream_resume(fs_work_t* work, fs_t* fs)
 {
-	if(work)
-		event_wait(work->done);
+	// The completion thread never waits on codec workers, so waiting for an I/O slot here is safe.
+	semaphore_aquire(fs->io_depth);
+	if (!fs_stream_next_block(work, fs, work->next_block_header, work->next_block_offset))
+	{
+		semaphore_release(fs->io_depth);
+	}
 }
 
-int fs_work_get_result(fs_work_t* work)
+static void fs_stream_decode_block(fs_block_t* block, fs_t* fs)
 {
-	fs_work_wait(work);
-	return work ? work->result:-1;
+	fs_work_t* work = block->work;
+	size_t capacity = block->output_offset < work->size ? work->size - block->output_offset : 0;
+	if (capacity > work->block_size)
+	{
+		capacity = work->block_size;
+	}
+
+	char* output = (char*)work->buffer + block->output_offset;
+	int bytes_decompressed = -1;
+	uint32_t checksum = 0;
+	if (work->block_checksum)
+	{
+		memcpy(&checksum, block->data + block->data_size, sizeof(checksum));
+	}
+	bool cancelled = fs_work_is_cancelled(work);
+	if (cancelled)
+	{
+		work->result = ERROR_CANCELLED;
+	}
+	else if (work->block_checksum && XXH32(block->data, block->data_size, 0) != checksum)
+	{
+		debug_print(k_print_error, "Checksum mismatch in block of '%s'\n", work->path);
+	}
+	else if (block->compressed)
+	{
+		bytes_decompressed = work->dictionary
+			? LZ4_decompress_safe_usingDict(block->data, output, block->data_size, (int)capacity, work->dictionary->data, work->dictionary->size)
+			: LZ4_decompress_safe(block->data, output, block->data_size, (int)capacity);
+	}
+	else if ((size_t)block->data_size <= capacity)
+	{
+		memcpy(output, block->data, block->data_size);
+		bytes_decompressed = block->data_size;
+	}
+
+	if (bytes_decompressed >= 0)
+	{
+		atomic_fetch_add64(&work->bytes_decompressed, bytes_decompressed);
+	}
+	else if (!cancelled)
+	{
+		debug_print(k_print_error, "Failed to decompress block of '%s'\n", work->path);
+		work->result = -1;
+	}
+	heap_free(fs->heap, block);
+	// Hand the credit back before dropping this block's reference, which may finish the work.
+	if (atomic_increment(&work->block_credits) < 0)
+	{
+		fs_stream_resume(work, fs);
+	}
+	fs_stream_release(work, fs);
 }
 
-void* fs_work_get_buffer(fs_work_t* work)
+static void file_read_failed(fs_work_t* work, fs_t* fs)
 {
-	fs_work_wait(work);
-	return work ? work->buffer : NULL;
+	if (work->read_stage == k_fs_read_stage_frame_blocks)
+	{
+		heap_free(fs->heap, work->block);
+		work->block = NULL;
+		atomic_decrement(&work->pending);
+		fs_stream_end(work, fs);
+		return;
+	}
+	work->size = 0;
+	file_finish(work, fs);
 }
 
-size_t fs_work_get_size(fs_work_t* work)
+// Returns true if a follow-up read was issued on the same I/O slot.
+static bool file_read_done(fs_work_t* work, fs_t* fs, size_t bytes_read)
 {
-	fs_work_wait(work);
-	return work ? work->size : 0;
+	switch (work->read_stage)
+	{
+		case k_fs_read_stage_frame_header:
+			return fs_stream_begin(work, fs, bytes_read);
+		case k_fs_read_stage_frame_blocks:
+			return fs_stream_block_read(work, fs, bytes_read);
+		case k_fs_read_stage_whole:
+		case k_fs_read_stage_block:
+			break;
+	}
+
+	file_close(work);
+	if (work->read_stage == k_fs_read_stage_block)
+	{
+		if (bytes_read != work->compressed_size)
+		{
+			debug_print(k_print_error, "Short read of compressed file '%s'\n", work->path);
+			work->result = -1;
+			work->size = 0;
+			fs_work_complete(fs, work);
+			return false;
+		}
+		// Decompression null terminates; the buffer belongs to the compression workers from here.
+		fs_queue_push(&fs->compression_queue, work, work->priority);
+		return false;
+	}
+
+	work->size = bytes_read;
+	if (work->null_terminate)
+	{
+		((char*) work->buffer)[work->size] = 0;
+	}
+	fs_work_complete(fs, work);
+	return false;
 }
 
-void fs_work_destroy(fs_work_t* work)
+// Pack data is page aligned; the view starts on the allocation granularity boundary at or before it.
+static void file_read_mapped_pack_entry(fs_work_t* work, fs_t* fs, fs_pack_t* pack, const pack_entry_t* entry)
 {
-	if (work)
+	if (entry->compression != k_pack_compression_none)
 	{
-		if(work->use_compression || work->op == k_fs_work_op_read)
-			heap_free(work->heap, work->buffer);
-		event_wait(work->done);
-		event_destroy(work->done);
-		heap_free(work->heap, work);
+		debug_print(k_print_error, "Cannot map compressed pack entry '%s'\n", work->path);
+		work->result = -1;
+		fs_work_complete(fs, work);
+		return;
+	}
+	if (entry->size == 0)
+	{
+		fs_work_complete(fs, work);
+		return;
+	}
+
+	uint64_t view_offset = entry->offset - entry->offset % fs->allocation_granularity;
+	size_t view_skip = (size_t)(entry->offset - view_offset);
+	work->view = MapViewOfFile(pack->mapping, FILE_MAP_READ, (DWORD)(view_offset >> 32), (DWORD)view_offset, view_skip + (size_t)entry->size);
+	if (work->view == NULL)
+	{
+		work->result = GetLastError();
+	}
+	else
+	{
+		work->buffer = (char*)work->view + view_skip;
+		work->size = (size_t)entry->size;
 	}
+	fs_work_complete(fs, work);
 }
 
-static void file_read(fs_work_t* work, fs_t* fs)
+static void file_read_mapped(fs_work_t* work, fs_t* fs)
 {
+	fs_pack_t* pack = NULL;
+	const pack_entry_t* entry = fs_find_pack_entry(fs, work->path, &pack);
+	if (entry)
+	{
+		file_read_mapped_pack_entry(work, fs, pack, entry);
+		return;
+	}
+
 	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, _countof(wide_path)) <= 0)
 	{
 		work->result = -1;
+		fs_work_complete(fs, work);
 		return;
 	}
 	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
 		work->result = GetLastError();
+		fs_work_complete(fs, work);
 		return;
 	}
 
-	if (!GetFileSizeEx(handle, (PLARGE_INTEGER)&work->size))
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size))
 	{
 		work->result = GetLastError();
 		CloseHandle(handle);
+		fs_work_complete(fs, work);
 		return;
 	}
-	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
-
-	DWORD bytes_read = 0; 
-	if(!ReadFile(handle, work->buffer, (DWORD) work->size, &bytes_read, NULL))
+	// A 32-bit process cannot map the whole of a file this large.
+	if ((uint64_t)file_size.QuadPart > SIZE_MAX)
 	{
-		work->result = GetLastError();
+		work->result = ERROR_FILE_TOO_LARGE;
 		CloseHandle(handle);
+		fs_work_complete(fs, work);
 		return;
 	}
+	work->size = (size_t)file_size.QuadPart;
 
-	CloseHandle(handle);
-
-	if (work->use_compression)
+	// Empty files cannot be mapped; they simply have no buffer.
+	if (work->size == 0)
 	{
-		char compression_buffer[16];
-		for (int k = 0; k < 16; k++)
-		{
-			compression_buffer[k] = ((char*) work->buffer)[k];
-			if (compression_buffer[k] == '\n')
-			{
-				compression_buffer[k] = 0;
-				break;
-			}
-		}
-		work->compression_size = atoi(compression_buffer);
-		work->size -= strlen(compression_buffer) + 1; 
-		for (unsigned int k = 0; k < work->size; k++)
-			((char*)work->buffer)[k] = ((char*)work->buffer)[k + strlen(compression_buffer) + 1];
-
-		queue_push(fs->compression_queue, work);
+		CloseHandle(handle);
+		fs_work_complete(fs, work);
+		return;
 	}
 
-	if (work->null_terminate)
+	HANDLE mapping = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
 	{
-		((char*) work->buffer)[bytes_read] = 0;
+		work->result = GetLastError();
+		work->size = 0;
+		CloseHandle(handle);
+		fs_work_complete(fs, work);
+		return;
 	}
 
-	if (!work->use_compression)
+	// The view keeps the mapping and file open, so both handles can go right away.
+	work->view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	work->buffer = work->view;
+	if (work->buffer == NULL)
 	{
-		event_signal(work->done);
+		work->result = GetLastError();
+		work->size = 0;
 	}
+	CloseHandle(mapping);
+	CloseHandle(handle);
+	fs_work_complete(fs, work);
 }
 
-static void file_write(fs_work_t* work)
+// Atomic writes go to a temporary file beside the target.
+static void file_get_temp_path(fs_work_t* work, char* path, size_t path_size)
 {
-	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	sprintf_s(path, path_size, "%s.tmp", work->path);
+}
+
+static void file_write(fs_work_t* work, fs_t* fs)
+{
+	char temp_path[1024 + 8];
+	const char* path = work->path;
+	if (work->atomic)
 	{
-		work->result = -1;
+		file_get_temp_path(work, temp_path, sizeof(temp_path));
+		path = temp_path;
+	}
+	work->file = file_open_overlapped(work, fs, path, GENERIC_WRITE, FILE_SHARE_WRITE, work->append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL);
+	if (work->file == INVALID_HANDLE_VALUE)
+	{
+		fs_work_complete(fs, work);
 		return;
 	}
-	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == INVALID_HANDLE_VALUE)
+	LARGE_INTEGER offset = { 0 };
+	if (work->append && !GetFileSizeEx(work->file, &offset))
 	{
 		work->result = GetLastError();
+		file_finish(work, fs);
 		return;
 	}
-
-	DWORD compress_info_bytes_written = 0;
-	if (work->use_compression)
+	if (!file_submit(work, fs, work->buffer, work->size, offset.QuadPart))
 	{
-		char uncompressed_size_str[16];
-		sprintf_s(uncompressed_size_str, 16, "%zd\n", work->compression_size);
-		if(!WriteFile(handle, uncompressed_size_str, (DWORD) strlen(uncompressed_size_str), &compress_info_bytes_written, NULL))
+		if (work->atomic)
 		{
-			debug_print(k_print_error, "Failed to write compression data to file, aborting write operation\n");
-			work->result = GetLastError();
-			CloseHandle(handle);
+			// Cleans up the temporary file.
+			file_commit(work, fs);
 			return;
 		}
-		SetEndOfFile(handle);
+		file_finish(work, fs);
 	}
+}
+
+// The data of an atomic write is down. Flush it to the device and rename it over the target,
+// so readers see the old file or the new one and never a torn one. Flushing blocks, which is
+// why this runs on a file thread rather than the completion thread.
+static void file_commit(fs_work_t* work, fs_t* fs)
+{
+	char temp_path[1024 + 8];
+	wchar_t wide_temp_path[1024 + 8];
+	wchar_t wide_path[1024];
+	file_get_temp_path(work, temp_path, sizeof(temp_path));
+	bool converted = MultiByteToWideChar(CP_UTF8, 0, temp_path, -1, wide_temp_path, _countof(wide_temp_path)) > 0 &&
+		MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, _countof(wide_path)) > 0;
 
-	DWORD bytes_written = 0;
-	if(!WriteFile(handle, work->buffer, (DWORD) work->size, &bytes_written, NULL))
+	if (work->result == 0 && !FlushFileBuffers(work->file))
 	{
-		debug_print(k_print_error, "Failed to write data to file, aborting write operation\n");
 		work->result = GetLastError();
-		CloseHandle(handle);
-		return;
 	}
-	
-	work->size = bytes_written + compress_info_bytes_written;
-	CloseHandle(handle);
-	event_signal(work->done);
+	CloseHandle(work->file);
+	if (work->result == 0 && !MoveFileEx(wide_temp_path, wide_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		work->result = GetLastError();
+	}
+	if (work->result != 0)
+	{
+		debug_print(k_print_error, "Failed to replace file '%s'\n", work->path);
+		if (converted)
+		{
+			DeleteFile(wide_temp_path);
+		}
+	}
+	fs_work_complete(fs, work);
+}
+
+// Park a write whose turn has not come on its lane. The serving check is repeated under the
+// lane mutex so the completion that reaches its ticket cannot miss it.
+static bool file_park_write(fs_work_t* work, fs_t* fs)
+{
+	fs_write_lane_t* lane = &fs->write_lanes[work->write_lane];
+	if (atomic_load(&lane->serving) == work->write_ticket)
+	{
+		return false;
+	}
+	bool parked = false;
+	mutex_lock(fs->write_lane_mutex);
+	if (atomic_load(&lane->serving) != work->write_ticket)
+	{
+		work->lane_next = lane->parked;
+		lane->parked = work;
+		parked = true;
+	}
+	mutex_unlock(fs->write_lane_mutex);
+	return parked;
 }
 
 static int file_thread_func(void* user)
@@ -259,19 +1825,47 @@ static int file_thread_func(void* user)
 	fs_t* fs = user;
 	while (1)
 	{
-		fs_work_t* work = queue_pop(fs->file_queue);
+		fs_work_t* work = fs_queue_pop(&fs->file_queue);
 		if (work == NULL)
 		{
-			break;
+			return 0;
 		}
 
 		switch (work->op)
 		{
 			case k_fs_work_op_read:
+				if (fs_work_is_cancelled(work))
+				{
+					fs_work_complete_cancelled(fs, work);
+					break;
+				}
 				file_read(work, fs);
 				break;
+			case k_fs_work_op_read_mapped:
+				if (fs_work_is_cancelled(work))
+				{
+					fs_work_complete_cancelled(fs, work);
+					break;
+				}
+				file_read_mapped(work, fs);
+				break;
 			case k_fs_work_op_write:
-				file_write(work);
+				if (file_park_write(work, fs))
+				{
+					break;
+				}
+				if (work->committing)
+				{
+					file_commit(work, fs);
+					break;
+				}
+				// Only dropped on its turn, so later writes to the lane keep their order.
+				if (fs_work_is_cancelled(work))
+				{
+					fs_work_complete_cancelled(fs, work);
+					break;
+				}
+				file_write(work, fs);
 				break;
 		}
 	}
@@ -284,48 +1878,188 @@ static int compression_thread_func(void* user)
 	fs_t* fs = user;
 	while (1)
 	{
-		fs_work_t* work = queue_pop(fs->compression_queue);
-		if(work == NULL)
-			break;
+		fs_work_t* work = fs_queue_pop(&fs->compression_queue);
+		if (work == NULL)
+		{
+			return 0;
+		}
 
 		switch (work->op)
 		{
 			case k_fs_work_op_write:
 			{
-				uint32_t buffer_size = LZ4_compressBound(work->size);
+				// Independent blocks let reads decompress them in parallel, and the recorded
+				// content size lets reads allocate the output before any block arrives.
+				// Block checksums are verified by the worker decompressing each block.
+				// With a dictionary, every block is compressed against it independently.
+				LZ4F_preferences_t preferences;
+				memset(&preferences, 0, sizeof(preferences));
+				preferences.frameInfo.blockSizeID = FS_FRAME_BLOCK_SIZE;
+				preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+				preferences.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+				preferences.frameInfo.contentSize = work->size;
+				preferences.compressionLevel = work->compression_level;
+				const fs_dictionary_t* dictionary = NULL;
+				if (work->dictionary_id)
+				{
+					dictionary = fs_find_dictionary(fs, work->dictionary_id);
+					if (!dictionary)
+					{
+						debug_print(k_print_error, "Failed to compress '%s'; dictionary %u has not been added\n", work->path, work->dictionary_id);
+						work->buffer = NULL;
+						work->result = -1;
+						fs_work_complete(fs, work);
+						break;
+					}
+					// Lets reads find the dictionary again.
+					preferences.frameInfo.dictID = work->dictionary_id;
+				}
+				size_t buffer_size = LZ4F_compressFrameBound(work->size, &preferences);
 				void* compression_buffer = heap_alloc(work->heap, buffer_size, 8);
-				uint32_t compressed_size = LZ4_compress_default(work->buffer, compression_buffer, work->size, buffer_size);
-				if (compressed_size == 0)
+				size_t compressed_size;
+				if (dictionary)
+				{
+					LZ4F_cctx* context = NULL;
+					compressed_size = LZ4F_createCompressionContext(&context, LZ4F_VERSION);
+					if (!LZ4F_isError(compressed_size))
+					{
+						compressed_size = LZ4F_compressFrame_usingCDict(context, compression_buffer, buffer_size, work->buffer, work->size, dictionary->cdict, &preferences);
+					}
+					LZ4F_freeCompressionContext(context);
+				}
+				else
+				{
+					compressed_size = LZ4F_compressFrame(compression_buffer, buffer_size, work->buffer, work->size, &preferences);
+				}
+				if (LZ4F_isError(compressed_size))
 				{
-					debug_print(k_print_error, "Failed to compress file; LZ4 returned 0");
-					event_signal(work->done);
+					debug_print(k_print_error, "Failed to compress file; %s\n", LZ4F_getErrorName(compressed_size));
+					heap_free(work->heap, compression_buffer);
+					// The caller's buffer is not ours to free in fs_work_destroy.
+					work->buffer = NULL;
+					work->result = -1;
+					fs_work_complete(fs, work);
 					break;
 				}
-				work->compression_size = work->size;
 				work->size = compressed_size;
 				work->buffer = compression_buffer;
-				queue_push(fs->file_queue, work);
+				fs_queue_push(&fs->file_queue, work, work->priority);
 				break;
 			}
+			case k_fs_work_op_decode_block:
+				fs_stream_decode_block((fs_block_t*)work, fs);
+				break;
 			case k_fs_work_op_read:
 			{
-				void* compression_buffer = heap_alloc(work->heap, work->compression_size + 1, 8); // + 1 to accomodate null terminator
-				uint32_t bytes_decompressed = LZ4_decompress_safe(work->buffer, compression_buffer, work->size, work->compression_size);
-				((char*) compression_buffer)[bytes_decompressed] = 0;
-				if (bytes_decompressed <= 0)
+				if (fs_work_is_cancelled(work))
 				{
-					debug_print(k_print_error, "Failed to decompress file; LZ4 returned%d\n", bytes_decompressed);
-					event_signal(work->done);
+					fs_work_complete_cancelled(fs, work);
 					break;
 				}
-				work->size = bytes_decompressed;
-				heap_free(fs->heap, work->buffer);
-				work->buffer = compression_buffer;
-				event_signal(work->done);
+				char* buffer = work->buffer;
+				int bytes_decompressed = LZ4_decompress_safe(buffer + work->compressed_offset, buffer, (int)work->compressed_size, (int)work->size);
+				if (bytes_decompressed < 0 || (size_t)bytes_decompressed != work->size)
+				{
+					debug_print(k_print_error, "Failed to decompress file; LZ4 returned %d\n", bytes_decompressed);
+					work->result = -1;
+					work->size = 0;
+					fs_work_complete(fs, work);
+					break;
+				}
+				buffer[bytes_decompressed] = 0;
+				fs_work_complete(fs, work);
 				break;
 			}
 		}
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+static int completion_thread_func(void* user)
+{
+	fs_t* fs = user;
+	while (1)
+	{
+		OVERLAPPED_ENTRY entries[FS_MAX_COMPLETION_BATCH];
+		ULONG count = 0;
+		if (!GetQueuedCompletionStatusEx(fs->completion_port, entries, _countof(entries), &count, INFINITE, FALSE))
+		{
+			continue;
+		}
+		for (ULONG i = 0; i < count; ++i)
+		{
+			if (entries[i].lpOverlapped == NULL)
+			{
+				return 0;
+			}
+
+			fs_work_t* work = CONTAINING_RECORD(entries[i].lpOverlapped, fs_work_t, overlapped);
+			DWORD bytes_transferred = 0;
+			bool succeeded = GetOverlappedResult(work->file, &work->overlapped, &bytes_transferred, FALSE);
+			if (succeeded)
+			{
+				work->io_done += bytes_transferred;
+				// Go on with a chunked transfer, unless the file ended early. Reads stop if
+				// cancelled; writes carry on so files are never left partially written.
+				if (bytes_transferred > 0 && work->io_done < work->io_size)
+				{
+					if (work->op == k_fs_work_op_write || !fs_work_is_cancelled(work))
+					{
+						if (file_issue_chunk(work))
+						{
+							continue;
+						}
+					}
+					succeeded = false;
+				}
+			}
+			if (!succeeded && fs_work_is_cancelled(work))
+			{
+				work->result = ERROR_CANCELLED;
+			}
+			else if (!succeeded)
+			{
+				work->result = GetLastError();
+				debug_print(k_print_error, "Failed to %s file '%s'\n", work->op == k_fs_work_op_write ? "write" : "read", work->path);
+			}
+
+			if (work->op == k_fs_work_op_read)
+			{
+				// Reads may take several operations and close the file themselves. A follow-up
+				// read keeps the I/O slot; taking a fresh one here could wait on completions
+				// only this thread can deliver.
+				bool continued = false;
+				if (succeeded)
+				{
+					continued = file_read_done(work, fs, work->io_done);
+				}
+				else
+				{
+					file_read_failed(work, fs);
+				}
+				if (!continued)
+				{
+					semaphore_release(fs->io_depth);
+				}
+				continue;
+			}
+			semaphore_release(fs->io_depth);
+			work->size = work->io_done;
+			if (work->atomic)
+			{
+				// A short write would leave a torn file, which is what atomic writes exist to avoid.
+				if (work->result == 0 && work->io_done != work->io_size)
+				{
+					work->result = -1;
+				}
+				work->committing = true;
+				fs_queue_push(&fs->file_queue, work, work->priority);
+				continue;
+			}
+			file_finish(work, fs);
+		}
+	}
+
+	return 0;
+}
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 //asynchronous read/write file system with LZ4 compression
-//compressed files will be stored with the size of the uncompressed file and a newline character preceeding the compressed data
+//writes can trade compression time for size with LZ4HC levels, and compress many small files against a shared dictionary; neither slows reads down
+//compressed files are stored as LZ4 frames of independent blocks; on read, blocks are decompressed in parallel as they arrive
+//files in the older format, the size of the uncompressed file and a newline character preceeding the compressed data, can still be read
 
 //handle to file work
 typedef struct fs_work_t fs_work_t;
@@ -11,16 +15,135 @@ typedef struct fs_work_t fs_work_t;
 //handle to file system
 typedef struct fs_t fs_t;
 
+//handle to a group of file work that is waited on as one
+typedef struct fs_batch_t fs_batch_t;
+
 typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+//called once file work has completed, successfully or not
+//the work may be destroyed from the callback, and must not be destroyed before it has run
+typedef void (*fs_callback_t)(fs_work_t* work, void* data);
+
+//where a completion callback runs
+typedef enum fs_callback_dispatch_t
+{
+	//on the fs thread that completed the work; keep it short, it holds up other file work
+	k_fs_callback_immediate,
+	//as a job on callback_jobs
+	k_fs_callback_job,
+	//queued until a thread, usually the main thread, calls fs_run_callbacks
+	k_fs_callback_deferred,
+} fs_callback_dispatch_t;
+
+//file system configuration
+typedef struct fs_options_t
+{
+	//number of in-flight file operations; fs_read/fs_write block while this many are outstanding
+	int queue_capacity;
+	//threads opening files and submitting reads and writes; opening is synchronous, so several of them help with many small files
+	//zero or less picks a default
+	int io_worker_count;
+	//threads running LZ4 compression and decompression; zero or less picks one per two job worker cores
+	int codec_worker_count;
+	//reads and writes submitted to the device at once as overlapped I/O; zero or less picks a default
+	//deeper queues let the device reorder and merge requests, which matters most for many small files
+	int io_queue_depth;
+} fs_options_t;
+
+//urgency of a read. queued work is started most urgent first, and in order within a priority
+typedef enum fs_priority_t
+{
+	//needed this frame
+	k_fs_priority_high,
+	k_fs_priority_normal,
+	//prefetch; only started when nothing more urgent is waiting
+	k_fs_priority_low,
+
+	k_fs_priority_count,
+} fs_priority_t;
+
+//read parameters beyond the path; see fs_read
+typedef struct fs_read_options_t
+{
+	bool null_terminate;
+	bool use_compression;
+	fs_priority_t priority;
+	//optional; called when the read completes
+	fs_callback_t callback;
+	void* callback_data;
+	fs_callback_dispatch_t callback_dispatch;
+	//job system for k_fs_callback_job
+	job_system_t* callback_jobs;
+	//optional; the read counts towards this batch until it, and its callback, have finished
+	fs_batch_t* batch;
+	//read length bytes starting at offset instead of the whole file; a length of zero reads to the end
+	//not available with use_compression or for compressed pack entries, whose data must be decoded from the start
+	uint64_t offset;
+	size_t length;
+} fs_read_options_t;
+
+//write parameters beyond the path and data; see fs_write
+typedef struct fs_write_options_t
+{
+	bool use_compression;
+	//LZ4 compression level. zero is the fast default, negative values are faster still and compress less
+	//3 to 12 use LZ4HC, spending more time compressing for smaller files; 1 and 2 compress like zero
+	//decompression is equally fast at every level, so offline-cooked data should use a high one
+	int compression_level;
+	//optional; compress against the dictionary added under this id with fs_add_dictionary
+	unsigned int dictionary_id;
+	//add to the end of the file instead of replacing it; not available with use_compression or atomic
+	bool append;
+	//write to a temporary file beside the target, flush it to the device and rename it over the target
+	//the file is then either the old one or the new one, never a torn mix, even if the process dies mid write
+	bool atomic;
+	//copy the data into a buffer for its path and complete at once. buffered writes to a path are coalesced:
+	//appends accumulate, and a write that replaces the file discards what was buffered before it
+	//buffers are written once they grow large, before any other write to the path, and by fs_flush;
+	//an atomic buffer is only written by those last two, so it still replaces the file in one piece
+	//errors writing buffered data are reported by fs_flush. ignored with use_compression
+	bool write_behind;
+	//optional; called when the write completes. a write_behind write completes before fs_write_with_options
+	//returns, so an immediate callback runs on the calling thread
+	fs_callback_t callback;
+	void* callback_data;
+	fs_callback_dispatch_t callback_dispatch;
+	//job system for k_fs_callback_job
+	job_system_t* callback_jobs;
+	//optional; the write counts towards this batch until it, and its callback, have finished
+	fs_batch_t* batch;
+} fs_write_options_t;
 
 //create new file system.
 //given heap will be used to allocate space for queue and work buffers
 //given queue size will define number of in-flight file operations
 fs_t* fs_create(heap_t* heap, int queue_capacity);
 
+//create new file system with explicit worker pool sizes.
+//reads complete in any order; writes to the same path are applied in the order they were queued
+fs_t* fs_create_with_options(heap_t* heap, const fs_options_t* options);
+
 //destroy previously created file system
+//write_behind data still buffered is written out first
 void fs_destroy(fs_t* fs);
 
+//mount a pack file built with pack_build (see pack.h)
+//from then on fs_read and fs_read_mapped look paths up in mounted packs before opening individual files;
+//packs mounted later take precedence. entries are decompressed according to how they were packed.
+//writes always go to individual files. packs stay mounted until fs_destroy
+//reads the table of contents synchronously; intended for startup
+//returns false if the pack cannot be opened or is not valid
+bool fs_mount_pack(fs_t* fs, const char* path);
+
+//add a shared dictionary for compressed writes to use, and for reads of files written with it
+//many small files of the same kind compress poorly on their own; against a dictionary trained on samples of them
+//(see cook_train_dictionary) they compress like one large file. only the last 64KB of the dictionary is used
+//the data is copied. the id is stored in each compressed file, so a dictionary must keep its id and contents
+//for as long as files compressed with it exist
+//returns false if the id is zero or already taken, or too many dictionaries have been added
+bool fs_add_dictionary(fs_t* fs, unsigned int id, const void* data, size_t size);
+
 //queue file read
 //file at the specified path will be read in full
 //memory for the file will be allocated out of the provided heap
@@ -29,12 +152,39 @@ void fs_destroy(fs_t* fs);
 //returns a work object
 fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression);
 
+//queue file read with explicit options
+//fs_read queues at k_fs_priority_normal
+fs_work_t* fs_read_with_options(fs_t* fs, const char* path, heap_t* heap, const fs_read_options_t* options);
+
+//queue a read of part of a file, length bytes starting at offset
+//a range running past the end of the file is cut short; fs_work_get_size gives the bytes actually read
+//files of any size can be read this way, a piece at a time
+fs_work_t* fs_read_range(fs_t* fs, const char* path, heap_t* heap, uint64_t offset, size_t length);
+
+//queue a zero-copy file read
+//the file at the specified path is mapped into memory read-only instead of being copied into a heap buffer
+//pages come straight from the OS file cache and are only loaded when touched
+//the buffer stays valid until fs_work_destroy and must not be written to; it is not null terminated
+//an empty file completes successfully with a NULL buffer and a size of zero
+//use for large uncompressed data such as shader blobs that can be consumed in place
+fs_work_t* fs_read_mapped(fs_t* fs, const char* path);
+
 //queue a file write
-//file at the specified path will be read in full
-//memory for the file will be allocated out of the allocated heap
-//if use_compression, the data will be compressed and the uncompressed size of the data will be written to the target file before the actual data
+//the file at the specified path is created, or replaced, with size bytes from buffer
+//buffer is not copied and must stay valid until the work completes
+//if use_compression, the data is written as an LZ4 frame of independent blocks that records the uncompressed size,
+//compressed into a buffer allocated out of the fs heap; read it back with use_compression
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression);
 
+//queue a file write with explicit options
+//fs_write compresses at level zero without a dictionary
+fs_work_t* fs_write_with_options(fs_t* fs, const char* path, const void* buffer, size_t size, const fs_write_options_t* options);
+
+//write out all write_behind data, and wait for it and every write queued before the call to finish
+//use as a barrier, e.g. before reading back a save file or at the end of a frame's trace output
+//returns false if writing any write_behind data failed since the last fs_flush
+bool fs_flush(fs_t* fs);
+
 //if true, file work is complete
 bool fs_work_is_done(fs_work_t* work);
 
@@ -50,5 +200,29 @@ void* fs_work_get_buffer(fs_work_t* work);
 //get size associated with file operation
 size_t fs_work_get_size(fs_work_t* work);
 
+//cancel file work that is no longer needed
+//queued work is dropped without touching the file; an in-flight read is aborted and reads no further blocks
+//a write is only dropped if it has not started, so files are never left partially written
+//the work still completes: wait for or destroy it as usual. unless it had already finished, its result is non-zero and its size zero
+void fs_work_cancel(fs_work_t* work);
+
 //free file work object
 void fs_work_destroy(fs_work_t* work);
+
+//run completion callbacks queued with k_fs_callback_deferred, in the order their work completed
+//returns the number of callbacks run
+int fs_run_callbacks(fs_t* fs);
+
+//create a batch to wait on many pieces of file work at once
+//pass it in fs_read_options_t or fs_write_options_t as the work is queued
+fs_batch_t* fs_batch_create(fs_t* fs);
+
+//destroy a batch; waits for it to finish first
+void fs_batch_destroy(fs_batch_t* batch);
+
+//if true, all work in the batch has completed and its callbacks have run
+bool fs_batch_is_done(fs_batch_t* batch);
+
+//block until all work in the batch has completed and its callbacks have run
+//a thread waiting on a batch with deferred callbacks must not be the one that runs them
+void fs_batch_wait(fs_batch_t* batch);
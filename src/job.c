@@ -0,0 +1,426 @@
+#include "job.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+#include "mutex.h"
+#include "semaphore.h"
+#include "thread.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum
+{
+	k_job_deque_capacity = 4096, // must be a power of two
+	k_job_shared_capacity = 4096,
+	k_job_max_workers = 64,
+	k_job_spin_count = 1024,
+	k_job_cache_line = 64,
+};
+
+typedef struct job_t
+{
+	job_func_t func;
+	void* data;
+	job_counter_t* counter;
+} job_t;
+
+typedef struct job_counter_t
+{
+	int value;
+	char padding[k_job_cache_line - sizeof(int)];
+} job_counter_t;
+
+// Chase-Lev deque.
+// Only the owning worker touches bottom; any worker may advance top when stealing.
+// Top and bottom sit on separate cache lines so thieves do not thrash the owner.
+typedef struct job_deque_t
+{
+	int top;
+	char top_padding[k_job_cache_line - sizeof(int)];
+	int bottom;
+	char bottom_padding[k_job_cache_line - sizeof(int)];
+	job_t jobs[k_job_deque_capacity];
+} job_deque_t;
+
+typedef struct job_worker_t
+{
+	job_system_t* system;
+	thread_t* thread;
+	int index;
+	job_deque_t deque;
+} job_worker_t;
+
+typedef struct job_system_t
+{
+	heap_t* heap;
+	int worker_count;
+	int quit;
+	int sleeping_workers;
+	semaphore_t* wake;
+
+	// Jobs queued by threads that are not workers.
+	mutex_t* shared_mutex;
+	int shared_head;
+	int shared_tail;
+	int shared_count;
+	job_t shared_jobs[k_job_shared_capacity];
+
+	job_worker_t* workers[k_job_max_workers];
+} job_system_t;
+
+// Worker owned by the calling thread, if any.
+static __declspec(thread) job_worker_t* s_worker = NULL;
+
+static int job_worker_thread_func(void* user);
+
+static bool job_deque_push(job_deque_t* deque, const job_t* job)
+{
+	int bottom = deque->bottom;
+	int top = atomic_load_acquire(&deque->top);
+	if (bottom - top >= k_job_deque_capacity)
+	{
+		return false;
+	}
+	deque->jobs[bottom & (k_job_deque_capacity - 1)] = *job;
+	// Publish the job before the new bottom becomes visible to thieves.
+	atomic_store_release(&deque->bottom, bottom + 1);
+	return true;
+}
+
+static bool job_deque_pop(job_deque_t* deque, job_t* job)
+{
+	int bottom = deque->bottom - 1;
+	// Full barrier: the new bottom must be visible before top is read, or a thief and
+	// the owner could both take the last job.
+	atomic_exchange(&deque->bottom, bottom);
+	int top = atomic_load(&deque->top);
+	if (top > bottom)
+	{
+		atomic_store_release(&deque->bottom, bottom + 1);
+		return false;
+	}
+
+	*job = deque->jobs[bottom & (k_job_deque_capacity - 1)];
+	if (top == bottom)
+	{
+		// Last job; race thieves for it.
+		bool won = atomic_compare_and_exchange(&deque->top, top, top + 1) == top;
+		atomic_store_release(&deque->bottom, bottom + 1);
+		return won;
+	}
+	return true;
+}
+
+static bool job_deque_steal(job_deque_t* deque, job_t* job)
+{
+	int top = atomic_load(&deque->top);
+	int bottom = atomic_load(&deque->bottom);
+	if (top >= bottom)
+	{
+		return false;
+	}
+	*job = deque->jobs[top & (k_job_deque_capacity - 1)];
+	// Losing the race means another thread took the job; the copy is discarded.
+	return atomic_compare_and_exchange(&deque->top, top, top + 1) == top;
+}
+
+static bool job_shared_push(job_system_t* system, const job_t* job)
+{
+	bool pushed = false;
+	mutex_lock(system->shared_mutex);
+	if (system->shared_count < k_job_shared_capacity)
+	{
+		system->shared_jobs[system->shared_tail] = *job;
+		system->shared_tail = (system->shared_tail + 1) % k_job_shared_capacity;
+		system->shared_count++;
+		pushed = true;
+	}
+	mutex_unlock(system->shared_mutex);
+	return pushed;
+}
+
+static bool job_shared_pop(job_system_t* system, job_t* job)
+{
+	if (atomic_load(&system->shared_count) == 0)
+	{
+		return false;
+	}
+	bool popped = false;
+	mutex_lock(system->shared_mutex);
+	if (system->shared_count > 0)
+	{
+		*job = system->shared_jobs[system->shared_head];
+		system->shared_head = (system->shared_head + 1) % k_job_shared_capacity;
+		system->shared_count--;
+		popped = true;
+	}
+	mutex_unlock(system->shared_mutex);
+	return popped;
+}
+
+// Find a job for the calling thread: own deque first, then the shared queue, then steal.
+static bool job_find(job_system_t* system, job_worker_t* worker, job_t* job)
+{
+	if (worker && job_deque_pop(&worker->deque, job))
+	{
+		return true;
+	}
+	if (job_shared_pop(system, job))
+	{
+		return true;
+	}
+	int start = worker ? worker->index + 1 : 0;
+	for (int i = 0; i < system->worker_count; ++i)
+	{
+		job_worker_t* victim = system->workers[(start + i) % system->worker_count];
+		if (victim != worker && job_deque_steal(&victim->deque, job))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void job_execute(const job_t* job)
+{
+	job->func(job->data);
+	if (job->counter)
+	{
+		atomic_decrement(&job->counter->value);
+	}
+}
+
+static void job_wake_workers(job_system_t* system)
+{
+	// Compare-exchange as a full barrier, so a worker about to sleep either sees the
+	// new job or is counted here.
+	if (atomic_compare_and_exchange(&system->sleeping_workers, 0, 0) != 0)
+	{
+		semaphore_release(system->wake);
+	}
+}
+
+static int job_count_cores(uint64_t core_mask)
+{
+	int count = 0;
+	for (; core_mask; core_mask &= core_mask - 1)
+	{
+		++count;
+	}
+	return count;
+}
+
+// Pin each worker to its own core so its deque stays in that core's cache.
+// Worker zero, the creating thread, is left alone and nominally owns the first core.
+static uint64_t job_worker_core_mask(uint64_t core_mask, int worker_index)
+{
+	int index = 0;
+	for (uint64_t mask = core_mask; mask; mask &= mask - 1, ++index)
+	{
+		if (index == worker_index)
+		{
+			return mask & ~(mask - 1);
+		}
+	}
+	// More workers than cores: let the extras float over the worker cores.
+	return core_mask;
+}
+
+job_system_t* job_system_create(heap_t* heap, int worker_count)
+{
+	// Workers run on whatever cores are not reserved for dedicated threads (render, fs).
+	uint64_t core_mask = thread_get_worker_core_mask();
+	if (worker_count <= 0)
+	{
+		worker_count = job_count_cores(core_mask);
+		if (worker_count <= 0)
+		{
+			worker_count = thread_get_core_count();
+		}
+	}
+	if (worker_count > k_job_max_workers)
+	{
+		worker_count = k_job_max_workers;
+	}
+
+	job_system_t* system = heap_alloc(heap, sizeof(job_system_t), k_job_cache_line);
+	system->heap = heap;
+	system->worker_count = worker_count;
+	system->quit = 0;
+	system->sleeping_workers = 0;
+	system->wake = semaphore_create(0, worker_count);
+	system->shared_mutex = mutex_create();
+	system->shared_head = 0;
+	system->shared_tail = 0;
+	system->shared_count = 0;
+
+	for (int i = 0; i < worker_count; ++i)
+	{
+		job_worker_t* worker = heap_alloc(heap, sizeof(job_worker_t), k_job_cache_line);
+		worker->system = system;
+		worker->thread = NULL;
+		worker->index = i;
+		worker->deque.top = 0;
+		worker->deque.bottom = 0;
+		system->workers[i] = worker;
+	}
+
+	// Worker zero is the calling thread; the rest get their own threads.
+	s_worker = system->workers[0];
+	for (int i = 1; i < worker_count; ++i)
+	{
+		char name[k_thread_name_max];
+		sprintf_s(name, sizeof(name), "job worker %d", i);
+		thread_options_t options = { .name = name, .affinity_mask = job_worker_core_mask(core_mask, i), .priority = k_thread_priority_normal };
+		system->workers[i]->thread = thread_create_with_options(job_worker_thread_func, system->workers[i], &options);
+	}
+
+	return system;
+}
+
+void job_system_destroy(job_system_t* system)
+{
+	// Drain whatever is left on this thread before shutting workers down.
+	job_t job;
+	while (job_find(system, s_worker, &job))
+	{
+		job_execute(&job);
+	}
+
+	atomic_store(&system->quit, 1);
+	for (int i = 1; i < system->worker_count; ++i)
+	{
+		semaphore_release(system->wake);
+	}
+	for (int i = 1; i < system->worker_count; ++i)
+	{
+		thread_destroy(system->workers[i]->thread);
+	}
+
+	if (s_worker && s_worker->system == system)
+	{
+		s_worker = NULL;
+	}
+	for (int i = 0; i < system->worker_count; ++i)
+	{
+		heap_free(system->heap, system->workers[i]);
+	}
+	mutex_destroy(system->shared_mutex);
+	semaphore_destroy(system->wake);
+	heap_free(system->heap, system);
+}
+
+int job_system_get_worker_count(job_system_t* system)
+{
+	return system->worker_count;
+}
+
+void job_run(job_system_t* system, job_func_t func, void* data, job_counter_t* counter)
+{
+	job_t job = { .func = func, .data = data, .counter = counter };
+	if (counter)
+	{
+		atomic_increment(&counter->value);
+	}
+
+	job_worker_t* worker = (s_worker && s_worker->system == system) ? s_worker : NULL;
+	bool queued = worker ? job_deque_push(&worker->deque, &job) : job_shared_push(system, &job);
+	if (!queued)
+	{
+		// Out of queue space; doing the work now is better than dropping it or blocking.
+		job_execute(&job);
+		return;
+	}
+	job_wake_workers(system);
+}
+
+job_counter_t* job_counter_create(job_system_t* system)
+{
+	job_counter_t* counter = heap_alloc(system->heap, sizeof(job_counter_t), k_job_cache_line);
+	counter->value = 0;
+	return counter;
+}
+
+void job_counter_destroy(job_system_t* system, job_counter_t* counter)
+{
+	job_counter_wait(system, counter);
+	heap_free(system->heap, counter);
+}
+
+bool job_counter_is_done(job_counter_t* counter)
+{
+	return atomic_load_acquire(&counter->value) == 0;
+}
+
+void job_counter_wait(job_system_t* system, job_counter_t* counter)
+{
+	job_worker_t* worker = (s_worker && s_worker->system == system) ? s_worker : NULL;
+	int spins = 0;
+	while (!job_counter_is_done(counter))
+	{
+		job_t job;
+		if (job_find(system, worker, &job))
+		{
+			job_execute(&job);
+			spins = 0;
+		}
+		else if (++spins < k_job_spin_count)
+		{
+			YieldProcessor();
+		}
+		else
+		{
+			// The remaining jobs are running elsewhere; give up the time slice.
+			thread_sleep(0);
+		}
+	}
+}
+
+static int job_worker_thread_func(void* user)
+{
+	job_worker_t* worker = user;
+	job_system_t* system = worker->system;
+	s_worker = worker;
+
+	int spins = 0;
+	while (true)
+	{
+		job_t job;
+		if (job_find(system, worker, &job))
+		{
+			job_execute(&job);
+			spins = 0;
+			continue;
+		}
+		if (atomic_load(&system->quit))
+		{
+			break;
+		}
+		if (++spins < k_job_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+
+		// Announce we are going to sleep, then look once more so a job queued in between is not missed.
+		atomic_increment(&system->sleeping_workers);
+		if (job_find(system, worker, &job))
+		{
+			atomic_decrement(&system->sleeping_workers);
+			job_execute(&job);
+			spins = 0;
+			continue;
+		}
+		semaphore_aquire(system->wake);
+		atomic_decrement(&system->sleeping_workers);
+		spins = 0;
+	}
+
+	s_worker = NULL;
+	return 0;
+}
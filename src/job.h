@@ -0,0 +1,55 @@
+#pragma once
+
+// Work-stealing job system
+//
+// One worker per core, each with its own Chase-Lev deque. A worker pushes and pops jobs
+// at the bottom of its own deque and steals from the top of others' when it runs dry.
+// The thread that creates the job system acts as worker zero.
+// Completion is tracked with counters. A thread waiting on a counter keeps running jobs
+// until the counter reaches zero, so waiting inside a job is fine and is the way to express
+// dependencies between jobs.
+
+#include <stdbool.h>
+
+// Handle to a job system.
+typedef struct job_system_t job_system_t;
+
+// Handle to a job completion counter.
+typedef struct job_counter_t job_counter_t;
+
+typedef struct heap_t heap_t;
+
+// Function run by a job.
+typedef void (*job_func_t)(void* data);
+
+// Create a job system.
+// If worker_count is zero or less, one worker is created per core not reserved for dedicated threads.
+// The calling thread counts as one of the workers; the others are each pinned to a worker core.
+job_system_t* job_system_create(heap_t* heap, int worker_count);
+
+// Destroy a previously created job system.
+// Jobs still queued are run before the workers exit.
+void job_system_destroy(job_system_t* system);
+
+// Get the number of workers including the thread that created the job system.
+int job_system_get_worker_count(job_system_t* system);
+
+// Queue a job to run func(data) on any worker.
+// If counter is not NULL, it is incremented now and decremented once the job has run.
+// Safe to call from any thread. Jobs queued from outside the job system's workers go through a
+// shared queue; jobs queued from a worker go onto that worker's own deque.
+void job_run(job_system_t* system, job_func_t func, void* data, job_counter_t* counter);
+
+// Create a counter with a value of zero.
+job_counter_t* job_counter_create(job_system_t* system);
+
+// Destroy a previously created counter.
+// Waits for the counter to reach zero first.
+void job_counter_destroy(job_system_t* system, job_counter_t* counter);
+
+// If true, all jobs tracked by the counter have finished.
+bool job_counter_is_done(job_counter_t* counter);
+
+// Block until the counter reaches zero.
+// The calling thread runs queued jobs while it waits instead of sleeping.
+void job_counter_wait(job_system_t* system, job_counter_t* counter);
@@ -1,3 +1,4 @@
+#include "cook.h"
 #include "debug.h"
 #include "fs.h"
 #include "heap.h"
@@ -21,11 +22,22 @@ int main(int argc, const char* argv[])
 	debug_set_print_mask(k_print_info | k_print_warning | k_print_error);
 	//debug_install_exception_handler();
 
+	thread_set_name("main");
 	timer_startup();
 	debug_system_init(8);
 
 	heap_t* heap = heap_create(2 * 1024 * 1024, NULL);
 	fs_t* fs = fs_create(heap, 8);
+
+	// Cooking runs without a window and exits; the game loads what it wrote.
+	if (argc > 1 && strcmp(argv[1], "--cook") == 0)
+	{
+		int result = cook_assets(heap, fs) ? 0 : 1;
+		fs_destroy(fs);
+		heap_destroy(heap);
+		debug_system_uninit();
+		return result;
+	}
 	wm_window_t* window = wm_create(heap);
 	render_t* render = render_create(heap, window);
 
@@ -1,24 +1,132 @@
 #include "mutex.h"
 
+#include "atomic.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <string.h>
+
+#pragma comment(lib, "Synchronization.lib")
+
+enum
+{
+	k_mutex_unlocked = 0,
+	k_mutex_locked = 1,
+	k_mutex_locked_waiters = 2, // locked, and at least one thread may be asleep waiting
+
+	k_mutex_min_spins = 16,
+	k_mutex_max_spins = 4096,
+	k_mutex_cache_line = 64,
+};
+
+typedef struct mutex_t
+{
+	int state;
+	int owner;       // thread id of the owner, 0 when unlocked
+	int depth;       // recursion depth; only touched by the owner
+	int spin_limit;  // running estimate of how long spinning pays off
+#if defined(MUTEX_STATS)
+	mutex_stats_t stats;
+#endif
+} mutex_t;
 
 mutex_t* mutex_create()
 {
-	return (mutex_t*) CreateMutex(NULL, FALSE, NULL);
+	// Not allocated from heap_t: the heap itself is guarded by a mutex.
+	// Cache-line aligned so neighbouring data does not false-share with the lock word.
+	mutex_t* mutex = _aligned_malloc(sizeof(mutex_t), k_mutex_cache_line);
+	memset(mutex, 0, sizeof(mutex_t));
+	mutex->spin_limit = k_mutex_min_spins;
+	return mutex;
 }
 
 void mutex_destroy(mutex_t* mutex)
 {
-	CloseHandle(mutex);
+	_aligned_free(mutex);
 }
 
 void mutex_lock(mutex_t* mutex)
 {
-	WaitForSingleObject(mutex, INFINITE);
+	int thread_id = (int)GetCurrentThreadId();
+	if (atomic_load_relaxed(&mutex->owner) == thread_id)
+	{
+		mutex->depth++;
+		return;
+	}
+
+	int spins = 0;
+	int kernel_waits = 0;
+	if (atomic_compare_and_exchange(&mutex->state, k_mutex_unlocked, k_mutex_locked) != k_mutex_unlocked)
+	{
+		// Spin with a pause first; the owner is often about to release.
+		int max_spins = mutex->spin_limit * 2;
+		if (max_spins > k_mutex_max_spins)
+		{
+			max_spins = k_mutex_max_spins;
+		}
+		bool acquired = false;
+		while (spins < max_spins)
+		{
+			++spins;
+			YieldProcessor();
+			if (atomic_load_relaxed(&mutex->state) == k_mutex_unlocked &&
+				atomic_compare_and_exchange(&mutex->state, k_mutex_unlocked, k_mutex_locked) == k_mutex_unlocked)
+			{
+				acquired = true;
+				break;
+			}
+		}
+		// Move the estimate an eighth of the way toward what this acquisition needed.
+		mutex->spin_limit += (spins - mutex->spin_limit) / 8;
+		if (mutex->spin_limit < k_mutex_min_spins)
+		{
+			mutex->spin_limit = k_mutex_min_spins;
+		}
+
+		if (!acquired)
+		{
+			// Mark the lock as having waiters so unlock knows to wake one, then sleep until the
+			// state word changes. We may take the lock in the "waiters" state; that only costs a
+			// spurious wake later.
+			int locked_waiters = k_mutex_locked_waiters;
+			while (atomic_exchange(&mutex->state, k_mutex_locked_waiters) != k_mutex_unlocked)
+			{
+				++kernel_waits;
+				WaitOnAddress(&mutex->state, &locked_waiters, sizeof(int), INFINITE);
+			}
+		}
+	}
+
+	atomic_store_relaxed(&mutex->owner, thread_id);
+	mutex->depth = 1;
+#if defined(MUTEX_STATS)
+	mutex->stats.lock_count++;
+	mutex->stats.contended_count += spins > 0 || kernel_waits > 0;
+	mutex->stats.kernel_wait_count += kernel_waits > 0;
+	mutex->stats.spin_count += spins;
+#endif
 }
 
 void mutex_unlock(mutex_t* mutex)
 {
-	ReleaseMutex(mutex);
+	if (--mutex->depth > 0)
+	{
+		return;
+	}
+	atomic_store_relaxed(&mutex->owner, 0);
+	if (atomic_exchange(&mutex->state, k_mutex_unlocked) == k_mutex_locked_waiters)
+	{
+		WakeByAddressSingle(&mutex->state);
+	}
+}
+
+void mutex_get_stats(mutex_t* mutex, mutex_stats_t* stats)
+{
+#if defined(MUTEX_STATS)
+	*stats = mutex->stats;
+#else
+	memset(stats, 0, sizeof(*stats));
+#endif
 }
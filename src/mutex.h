@@ -1,10 +1,25 @@
 #pragma once
 
+#include <stdint.h>
+
 // Recursive mutex thread synchronization
+// Lives in user space: an uncontended lock or unlock is a single atomic operation.
+// Under contention a thread spins briefly, adapting how long to the lock's recent history,
+// and only then sleeps in the kernel until the owner releases it.
 
 // Handle to a mutex.
 typedef struct mutex_t mutex_t;
 
+// Contention counters for a mutex.
+// Only collected when built with MUTEX_STATS defined; otherwise all zero.
+typedef struct mutex_stats_t
+{
+	uint64_t lock_count;        // successful outermost locks
+	uint64_t contended_count;   // locks that found the mutex already held
+	uint64_t kernel_wait_count; // locks that had to sleep in the kernel
+	uint64_t spin_count;        // total spin iterations spent waiting
+} mutex_stats_t;
+
 //creates a new mutex
 mutex_t* mutex_create();
 
@@ -17,3 +32,7 @@ void mutex_lock(mutex_t* m);
 
 //unlocks a mutex
 void mutex_unlock(mutex_t* m);
+
+//copies the mutex's contention counters into stats
+//counters are updated while the mutex is held, so call this while holding it for an exact snapshot
+void mutex_get_stats(mutex_t* m, mutex_stats_t* stats);
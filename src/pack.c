@@ -0,0 +1,237 @@
+#include "pack.h"
+#include "debug.h"
+#include "heap.h"
+#include "l4z/lz4.h"
+#include "l4z/lz4hc.h"
+#include "l4z/xxhash.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct pack_source_t
+{
+	pack_entry_t entry;
+	const char* path;
+	void* data;
+} pack_source_t;
+
+uint64_t pack_hash_path(const char* path)
+{
+	return XXH64(path, strlen(path), 0);
+}
+
+const pack_entry_t* pack_find_entry(const pack_entry_t* entries, uint32_t entry_count, uint64_t path_hash)
+{
+	uint32_t low = 0;
+	uint32_t high = entry_count;
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+		if (entries[middle].path_hash < path_hash)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low < entry_count && entries[low].path_hash == path_hash ? &entries[low] : NULL;
+}
+
+static bool pack_widen(const char* path, wchar_t* wide_path, int wide_path_count)
+{
+	return MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, wide_path_count) > 0;
+}
+
+static HANDLE pack_open(const char* path, DWORD access, DWORD disposition)
+{
+	wchar_t wide_path[1024];
+	if (!pack_widen(path, wide_path, _countof(wide_path)))
+	{
+		return INVALID_HANDLE_VALUE;
+	}
+	return CreateFile(wide_path, access, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+static bool pack_write(HANDLE handle, const void* data, size_t size)
+{
+	const char* bytes = data;
+	while (size > 0)
+	{
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD bytes_written = 0;
+		if (!WriteFile(handle, bytes, chunk, &bytes_written, NULL) || bytes_written != chunk)
+		{
+			return false;
+		}
+		bytes += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+static bool pack_load_source(heap_t* heap, pack_source_t* source, const char* source_path, pack_compression_t compression)
+{
+	HANDLE handle = pack_open(source_path, GENERIC_READ, OPEN_EXISTING);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		debug_print(k_print_error, "Pack: failed to open '%s'\n", source_path);
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart > LZ4_MAX_INPUT_SIZE)
+	{
+		debug_print(k_print_error, "Pack: '%s' is too large\n", source_path);
+		CloseHandle(handle);
+		return false;
+	}
+
+	size_t size = (size_t)file_size.QuadPart;
+	char* data = heap_alloc(heap, size ? size : 1, 8);
+	DWORD bytes_read = 0;
+	bool read = ReadFile(handle, data, (DWORD)size, &bytes_read, NULL) && bytes_read == size;
+	CloseHandle(handle);
+	if (!read)
+	{
+		debug_print(k_print_error, "Pack: failed to read '%s'\n", source_path);
+		heap_free(heap, data);
+		return false;
+	}
+
+	source->entry.size = size;
+	source->entry.stored_size = size;
+	source->entry.compression = k_pack_compression_none;
+	source->data = data;
+	if (compression == k_pack_compression_none || size == 0)
+	{
+		return true;
+	}
+
+	int bound = LZ4_compressBound((int)size);
+	char* compressed = heap_alloc(heap, bound, 8);
+	int compressed_size = compression == k_pack_compression_lz4hc
+		? LZ4_compress_HC(data, compressed, (int)size, bound, LZ4HC_CLEVEL_DEFAULT)
+		: LZ4_compress_default(data, compressed, (int)size, bound);
+	if (compressed_size <= 0 || (size_t)compressed_size >= size)
+	{
+		heap_free(heap, compressed);
+		return true;
+	}
+	heap_free(heap, data);
+	source->entry.stored_size = compressed_size;
+	source->entry.compression = compression;
+	source->data = compressed;
+	return true;
+}
+
+static int pack_compare_sources(const void* a, const void* b)
+{
+	uint64_t hash_a = ((const pack_source_t*)a)->entry.path_hash;
+	uint64_t hash_b = ((const pack_source_t*)b)->entry.path_hash;
+	return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+static uint64_t pack_align(uint64_t offset)
+{
+	return (offset + k_pack_alignment - 1) & ~(uint64_t)(k_pack_alignment - 1);
+}
+
+bool pack_build(heap_t* heap, const char* pack_path, const pack_build_entry_t* entries, int entry_count)
+{
+	pack_source_t* sources = heap_alloc(heap, sizeof(pack_source_t) * (entry_count > 0 ? entry_count : 1), 8);
+	memset(sources, 0, sizeof(pack_source_t) * (entry_count > 0 ? entry_count : 1));
+
+	bool success = true;
+	for (int i = 0; i < entry_count && success; ++i)
+	{
+		sources[i].path = entries[i].path ? entries[i].path : entries[i].source_path;
+		sources[i].entry.path_hash = pack_hash_path(sources[i].path);
+		success = pack_load_source(heap, &sources[i], entries[i].source_path, entries[i].compression);
+	}
+
+	if (success)
+	{
+		qsort(sources, entry_count, sizeof(pack_source_t), pack_compare_sources);
+		for (int i = 1; i < entry_count; ++i)
+		{
+			if (sources[i].entry.path_hash == sources[i - 1].entry.path_hash)
+			{
+				debug_print(k_print_error, "Pack: '%s' and '%s' have the same path hash\n", sources[i - 1].path, sources[i].path);
+				success = false;
+				break;
+			}
+		}
+	}
+
+	// Written beside the target and renamed over it once complete, so a failed build leaves
+	// any existing pack untouched.
+	char temp_path[1024 + 8];
+	sprintf_s(temp_path, sizeof(temp_path), "%s.tmp", pack_path);
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	if (success)
+	{
+		handle = pack_open(temp_path, GENERIC_WRITE, CREATE_ALWAYS);
+		success = handle != INVALID_HANDLE_VALUE;
+	}
+
+	if (success)
+	{
+		pack_header_t header = { k_pack_magic, k_pack_version, entry_count, k_pack_alignment };
+		uint64_t offset = pack_align(sizeof(header) + sizeof(pack_entry_t) * entry_count);
+		for (int i = 0; i < entry_count; ++i)
+		{
+			sources[i].entry.offset = offset;
+			offset = pack_align(offset + sources[i].entry.stored_size);
+		}
+
+		success = pack_write(handle, &header, sizeof(header));
+		for (int i = 0; i < entry_count && success; ++i)
+		{
+			success = pack_write(handle, &sources[i].entry, sizeof(pack_entry_t));
+		}
+
+		// Pad every section out to the alignment so each entry starts on a page boundary.
+		static const char padding[k_pack_alignment] = { 0 };
+		uint64_t written = sizeof(header) + sizeof(pack_entry_t) * entry_count;
+		for (int i = 0; i < entry_count && success; ++i)
+		{
+			success = pack_write(handle, padding, (size_t)(sources[i].entry.offset - written)) &&
+				pack_write(handle, sources[i].data, (size_t)sources[i].entry.stored_size);
+			written = sources[i].entry.offset + sources[i].entry.stored_size;
+		}
+		success = success && FlushFileBuffers(handle);
+		CloseHandle(handle);
+
+		wchar_t wide_temp_path[1024 + 8];
+		wchar_t wide_pack_path[1024];
+		if (pack_widen(temp_path, wide_temp_path, _countof(wide_temp_path)))
+		{
+			success = success &&
+				pack_widen(pack_path, wide_pack_path, _countof(wide_pack_path)) &&
+				MoveFileEx(wide_temp_path, wide_pack_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+			if (!success)
+			{
+				DeleteFile(wide_temp_path);
+			}
+		}
+	}
+
+	if (!success)
+	{
+		debug_print(k_print_error, "Pack: failed to build '%s'\n", pack_path);
+	}
+	for (int i = 0; i < entry_count; ++i)
+	{
+		if (sources[i].data)
+		{
+			heap_free(heap, sources[i].data);
+		}
+	}
+	heap_free(heap, sources);
+	return success;
+}
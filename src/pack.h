@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pack files
+//
+// A pack bundles many files into one archive so a game can open a single file at startup
+// instead of hundreds. Layout:
+//	pack_header_t
+//	pack_entry_t[entry_count], sorted by path_hash
+//	entry data, each entry starting on a k_pack_alignment boundary
+//
+// Entries are keyed by the 64-bit xxHash of their path; the path itself is not stored.
+// Data is page aligned so uncompressed entries can be mapped and used in place.
+// Packs are mounted with fs_mount_pack.
+
+typedef struct heap_t heap_t;
+
+enum
+{
+	k_pack_magic = 0x4b504147, // "GAPK"
+	k_pack_version = 1,
+	k_pack_alignment = 4096,
+};
+
+typedef enum pack_compression_t
+{
+	k_pack_compression_none,
+	// A single LZ4 block.
+	k_pack_compression_lz4,
+	// A single LZ4 block compressed with LZ4HC; slower to build, same speed to load.
+	k_pack_compression_lz4hc,
+} pack_compression_t;
+
+typedef struct pack_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t alignment;
+} pack_header_t;
+
+typedef struct pack_entry_t
+{
+	uint64_t path_hash;
+	// Offset of the entry data from the start of the pack.
+	uint64_t offset;
+	// Size of the entry data as stored in the pack.
+	uint64_t stored_size;
+	// Size of the entry once decompressed.
+	uint64_t size;
+	uint32_t compression;
+	uint32_t reserved;
+} pack_entry_t;
+
+// A file to add to a pack.
+typedef struct pack_build_entry_t
+{
+	// Path of the file on disk.
+	const char* source_path;
+	// Path the entry is found by, exactly as it will be passed to fs_read.
+	// NULL uses source_path.
+	const char* path;
+	// Compression requested. Entries that do not shrink are stored uncompressed.
+	pack_compression_t compression;
+} pack_build_entry_t;
+
+// Hash a path the way pack entries are keyed.
+uint64_t pack_hash_path(const char* path);
+
+// Find an entry in a table of contents sorted by path hash.
+// Returns NULL if the path is not in the table.
+const pack_entry_t* pack_find_entry(const pack_entry_t* entries, uint32_t entry_count, uint64_t path_hash);
+
+// Build a pack from files on disk, replacing any file at pack_path.
+// The pack is written to pack_path.tmp and renamed into place, so if the build fails an existing pack is kept.
+// Intended for offline tools: every source file is loaded and compressed in memory first.
+// Returns false if a source file cannot be read, two entries share a path, or the pack cannot be written.
+bool pack_build(heap_t* heap, const char* pack_path, const pack_build_entry_t* entries, int entry_count);
@@ -1,52 +1,342 @@
+#include "queue.h"
+
 #include "atomic.h"
 #include "heap.h"
 #include "semaphore.h"
+#include "timer.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <limits.h>
+#include <stdbool.h>
+
+// Bounded multi-producer multi-consumer queue (Dmitry Vyukov's design).
+// Each cell carries a sequence number that says whose turn it is:
+//   sequence == position      -> free for the producer claiming that position
+//   sequence == position + 1  -> filled, ready for the consumer claiming that position
+// Producers and consumers claim positions with a compare-exchange and never touch a lock.
+// Threads only fall back to a semaphore after spinning on a full or empty queue.
+
+enum
+{
+	k_queue_cache_line = 64,
+	k_queue_spin_count = 256,
+};
+
+typedef struct queue_cell_t
+{
+	int sequence;
+	void* item;
+} queue_cell_t;
 
 typedef struct queue_t
 {
 	heap_t* heap;
-	semaphore_t* used_items;
-	semaphore_t* free_items;
-	void** items;
+	queue_cell_t* cells;
 	int capacity;
-	int head_index;
+	int mask;
+	semaphore_t* not_empty;
+	semaphore_t* not_full;
+	int waiting_pushers;
+	int waiting_poppers;
+	char tail_padding[k_queue_cache_line];
 	int tail_index;
+	char head_padding[k_queue_cache_line - sizeof(int)];
+	int head_index;
+	char end_padding[k_queue_cache_line - sizeof(int)];
 } queue_t;
 
+// Positions are compared as the signed distance between two wrapping counters,
+// so they keep working after the int wraps.
+static int queue_distance(int a, int b)
+{
+	return (int)((unsigned int)a - (unsigned int)b);
+}
+
+static int queue_next(int position, int offset)
+{
+	return (int)((unsigned int)position + (unsigned int)offset);
+}
+
+static bool queue_try_push_one(queue_t* queue, void* item)
+{
+	int position = atomic_load_relaxed(&queue->tail_index);
+	while (true)
+	{
+		queue_cell_t* cell = &queue->cells[position & queue->mask];
+		int distance = queue_distance(atomic_load_acquire(&cell->sequence), position);
+		if (distance == 0)
+		{
+			int prev = atomic_compare_and_exchange(&queue->tail_index, position, queue_next(position, 1));
+			if (prev == position)
+			{
+				cell->item = item;
+				atomic_store_release(&cell->sequence, queue_next(position, 1));
+				return true;
+			}
+			position = prev;
+		}
+		else if (distance < 0)
+		{
+			// Cell still holds an item from the previous lap: full.
+			return false;
+		}
+		else
+		{
+			position = atomic_load_relaxed(&queue->tail_index);
+		}
+	}
+}
+
+static bool queue_try_pop_one(queue_t* queue, void** item)
+{
+	int position = atomic_load_relaxed(&queue->head_index);
+	while (true)
+	{
+		queue_cell_t* cell = &queue->cells[position & queue->mask];
+		int distance = queue_distance(atomic_load_acquire(&cell->sequence), queue_next(position, 1));
+		if (distance == 0)
+		{
+			int prev = atomic_compare_and_exchange(&queue->head_index, position, queue_next(position, 1));
+			if (prev == position)
+			{
+				*item = cell->item;
+				atomic_store_release(&cell->sequence, queue_next(position, queue->capacity));
+				return true;
+			}
+			position = prev;
+		}
+		else if (distance < 0)
+		{
+			// Cell has not been filled for this lap yet: empty.
+			return false;
+		}
+		else
+		{
+			position = atomic_load_relaxed(&queue->head_index);
+		}
+	}
+}
+
+// Wake up to count threads sleeping on the semaphore.
+// The compare-exchange doubles as a full barrier, pairing with the waiter's increment
+// before its final retry, so a waiter either sees our item or is seen here.
+static void queue_wake(int* waiting, semaphore_t* semaphore, int count)
+{
+	int waiters = atomic_compare_and_exchange(waiting, 0, 0);
+	for (int i = 0; i < waiters && i < count; ++i)
+	{
+		semaphore_release(semaphore);
+	}
+}
+
 queue_t* queue_create(heap_t* heap, int capacity)
 {
-	queue_t* queue = heap_alloc(heap, sizeof(queue_t), 8);
-	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
-	queue->used_items = semaphore_create(0, capacity);
-	queue->free_items = semaphore_create(capacity, capacity);
+	// Round up to a power of two so positions map to cells with a mask.
+	int rounded = 1;
+	while (rounded < capacity)
+	{
+		rounded <<= 1;
+	}
+
+	queue_t* queue = heap_alloc(heap, sizeof(queue_t), k_queue_cache_line);
+	queue->cells = heap_alloc(heap, sizeof(queue_cell_t) * rounded, k_queue_cache_line);
+	for (int i = 0; i < rounded; ++i)
+	{
+		queue->cells[i].sequence = i;
+		queue->cells[i].item = NULL;
+	}
+	queue->not_empty = semaphore_create(0, INT_MAX);
+	queue->not_full = semaphore_create(0, INT_MAX);
 	queue->heap = heap;
-	queue->capacity = capacity;
+	queue->capacity = rounded;
+	queue->mask = rounded - 1;
+	queue->waiting_pushers = 0;
+	queue->waiting_poppers = 0;
 	queue->head_index = 0;
 	queue->tail_index = 0;
 	return queue;
 }
 
+int queue_get_capacity(queue_t* queue)
+{
+	return queue->capacity;
+}
+
 void queue_destroy(queue_t* queue)
 {
-	semaphore_destroy(queue->used_items);
-	semaphore_destroy(queue->free_items);
-	heap_free(queue->heap, queue->items);
+	semaphore_destroy(queue->not_empty);
+	semaphore_destroy(queue->not_full);
+	heap_free(queue->heap, queue->cells);
 	heap_free(queue->heap, queue);
 }
 
+// Milliseconds left before a deadline in timer ticks, or INFINITE for no deadline.
+static uint32_t queue_remaining_ms(uint64_t deadline)
+{
+	if (deadline == UINT64_MAX)
+	{
+		return INFINITE;
+	}
+	uint64_t now = timer_get_ticks();
+	if (now >= deadline)
+	{
+		return 0;
+	}
+	// Round up so a wait never ends before the deadline.
+	uint64_t ticks_per_second = timer_get_ticks_per_second();
+	return (uint32_t)(((deadline - now) * 1000 + ticks_per_second - 1) / ticks_per_second);
+}
+
+static uint64_t queue_deadline(uint32_t timeout_ms)
+{
+	if (timeout_ms == INFINITE)
+	{
+		return UINT64_MAX;
+	}
+	return timer_get_ticks() + (uint64_t)timeout_ms * timer_get_ticks_per_second() / 1000;
+}
+
+// Push items until all are pushed or the deadline passes. Returns the number pushed.
+static int queue_push_many_until(queue_t* queue, void** items, int count, uint64_t deadline)
+{
+	int pushed = 0;
+	int announced = 0;
+	int spins = 0;
+	while (pushed < count)
+	{
+		if (queue_try_push_one(queue, items[pushed]))
+		{
+			++pushed;
+			spins = 0;
+			continue;
+		}
+
+		// Full. Let consumers see what we have so far before waiting on them.
+		queue_wake(&queue->waiting_poppers, queue->not_empty, pushed - announced);
+		announced = pushed;
+		if (deadline == 0)
+		{
+			break;
+		}
+		if (++spins < k_queue_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+		atomic_increment(&queue->waiting_pushers);
+		if (queue_try_push_one(queue, items[pushed]))
+		{
+			atomic_decrement(&queue->waiting_pushers);
+			++pushed;
+			spins = 0;
+			continue;
+		}
+		uint32_t remaining_ms = queue_remaining_ms(deadline);
+		bool woken = remaining_ms > 0 && semaphore_aquire_timed(queue->not_full, remaining_ms);
+		atomic_decrement(&queue->waiting_pushers);
+		if (!woken && queue_remaining_ms(deadline) == 0)
+		{
+			break;
+		}
+		spins = 0;
+	}
+	queue_wake(&queue->waiting_poppers, queue->not_empty, pushed - announced);
+	return pushed;
+}
+
+// Pop up to max_count items, waiting until at least one is available or the deadline passes.
+static int queue_pop_many_until(queue_t* queue, void** items, int max_count, uint64_t deadline)
+{
+	int popped = 0;
+	int spins = 0;
+	while (true)
+	{
+		while (popped < max_count && queue_try_pop_one(queue, &items[popped]))
+		{
+			++popped;
+		}
+		if (popped > 0 || deadline == 0)
+		{
+			break;
+		}
+
+		if (++spins < k_queue_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+		atomic_increment(&queue->waiting_poppers);
+		if (queue_try_pop_one(queue, &items[0]))
+		{
+			atomic_decrement(&queue->waiting_poppers);
+			popped = 1;
+			break;
+		}
+		uint32_t remaining_ms = queue_remaining_ms(deadline);
+		bool woken = remaining_ms > 0 && semaphore_aquire_timed(queue->not_empty, remaining_ms);
+		atomic_decrement(&queue->waiting_poppers);
+		if (!woken && queue_remaining_ms(deadline) == 0)
+		{
+			// One last look so an item that raced the timeout is not left behind.
+			popped = queue_try_pop_one(queue, &items[0]) ? 1 : 0;
+			break;
+		}
+		spins = 0;
+	}
+	queue_wake(&queue->waiting_pushers, queue->not_full, popped);
+	return popped;
+}
+
 void queue_push(queue_t* queue, void* item)
 {
-	semaphore_aquire(queue->free_items);
-	int index = atomic_increment(&queue->tail_index) % queue->capacity;
-	queue->items[index] = item;
-	semaphore_release(queue->used_items);
+	queue_push_many_until(queue, &item, 1, UINT64_MAX);
 }
 
 void* queue_pop(queue_t* queue)
 {
-	semaphore_aquire(queue->used_items);
-	int index = atomic_increment(&queue->head_index) % queue->capacity;
-	void* item = queue->items[index];
-	semaphore_release(queue->free_items);
+	void* item = NULL;
+	queue_pop_many_until(queue, &item, 1, UINT64_MAX);
 	return item;
 }
+
+void queue_push_many(queue_t* queue, void** items, int count)
+{
+	queue_push_many_until(queue, items, count, UINT64_MAX);
+}
+
+int queue_pop_many(queue_t* queue, void** items, int max_count)
+{
+	return queue_pop_many_until(queue, items, max_count, UINT64_MAX);
+}
+
+bool queue_try_push(queue_t* queue, void* item)
+{
+	return queue_push_many_until(queue, &item, 1, 0) == 1;
+}
+
+bool queue_try_pop(queue_t* queue, void** item)
+{
+	return queue_pop_many_until(queue, item, 1, 0) == 1;
+}
+
+int queue_try_pop_many(queue_t* queue, void** items, int max_count)
+{
+	return queue_pop_many_until(queue, items, max_count, 0);
+}
+
+bool queue_push_timed(queue_t* queue, void* item, uint32_t timeout_ms)
+{
+	return queue_push_many_until(queue, &item, 1, queue_deadline(timeout_ms)) == 1;
+}
+
+bool queue_pop_timed(queue_t* queue, void** item, uint32_t timeout_ms)
+{
+	return queue_pop_many_until(queue, item, 1, queue_deadline(timeout_ms)) == 1;
+}
+
+int queue_pop_many_timed(queue_t* queue, void** items, int max_count, uint32_t timeout_ms)
+{
+	return queue_pop_many_until(queue, items, max_count, queue_deadline(timeout_ms));
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 // Thread-safe Queue container
+// Lock-free bounded ring; threads only block in the kernel when the queue is full or empty.
+
+#include <stdbool.h>
+#include <stdint.h>
 
 // Handle to a thread-safe queue.
 typedef struct queue_t queue_t;
@@ -8,8 +12,12 @@ typedef struct queue_t queue_t;
 typedef struct heap_t heap_t;
 
 //create queue with defined capacity
+//capacity is rounded up to the next power of two
 queue_t* queue_create(heap_t* heap, int capacity);
 
+//get the number of items the queue can hold, after rounding
+int queue_get_capacity(queue_t* queue);
+
 //destroy previously created queue
 void queue_destroy(queue_t* queue);
 
@@ -21,3 +29,34 @@ void queue_push(queue_t* queue, void* item);
 //safe for multiple threads to pop at the same time
 void* queue_pop(queue_t* queue);
 
+//push count items onto the queue in order. blocks while the queue is full
+//waiting consumers are woken once for the batch rather than once per item
+void queue_push_many(queue_t* queue, void** items, int count);
+
+//pop up to max_count items off the queue (FIFO) into items. blocks until at least one item is available
+//returns the number of items popped
+int queue_pop_many(queue_t* queue, void** items, int max_count);
+
+//push item onto queue if there is space. never blocks
+//returns false if the queue was full
+bool queue_try_push(queue_t* queue, void* item);
+
+//pop an item off the queue if one is available. never blocks
+//returns false if the queue was empty
+bool queue_try_pop(queue_t* queue, void** item);
+
+//pop up to max_count items that are already in the queue. never blocks
+//returns the number of items popped, which may be zero
+int queue_try_pop_many(queue_t* queue, void** items, int max_count);
+
+//push item onto queue, waiting at most timeout_ms for space
+//returns false if the wait timed out
+bool queue_push_timed(queue_t* queue, void* item, uint32_t timeout_ms);
+
+//pop an item off the queue, waiting at most timeout_ms for one to arrive
+//returns false if the wait timed out
+bool queue_pop_timed(queue_t* queue, void** item, uint32_t timeout_ms);
+
+//pop up to max_count items, waiting at most timeout_ms for the first one to arrive
+//returns the number of items popped, zero on timeout
+int queue_pop_many_timed(queue_t* queue, void** items, int max_count, uint32_t timeout_ms);
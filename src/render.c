@@ -3,7 +3,8 @@
 #include "ecs.h"
 #include "gpu.h"
 #include "heap.h"
-#include "queue.h"
+#include "semaphore.h"
+#include "spsc_ring.h"
 #include "thread.h"
 #include "wm.h"
 
@@ -13,14 +14,18 @@
 enum
 {
 	k_render_max_drawables = 512,
+	k_render_max_frames_queued = 2,
+	k_render_ring_size = 1024 * 1024,
 };
 
 typedef enum command_type_t
 {
 	k_command_frame_done,
 	k_command_model,
+	k_command_quit,
 } command_type_t;
 
+// Built in place in the render ring. Uniform data immediately follows the command.
 typedef struct model_command_t
 {
 	command_type_t type;
@@ -64,7 +69,8 @@ typedef struct render_t
 	wm_window_t* window;
 	thread_t* thread;
 	gpu_t* gpu;
-	queue_t* queue;
+	spsc_ring_t* ring;
+	semaphore_t* frames_available;
 
 	int frame_counter;
 	int gpu_frame_count;
@@ -88,40 +94,54 @@ render_t* render_create(heap_t* heap, wm_window_t* window)
 	render_t* render = heap_alloc(heap, sizeof(render_t), 8);
 	render->heap = heap;
 	render->window = window;
-	render->queue = queue_create(heap, 3);
+	render->ring = spsc_ring_create(heap, k_render_ring_size);
+	render->frames_available = semaphore_create(k_render_max_frames_queued, k_render_max_frames_queued);
 	render->frame_counter = 0;
 	render->instance_count = 0;
 	render->mesh_count = 0;
 	render->shader_count = 0;
-	render->thread = thread_create(render_thread_func, render);
+	thread_options_t thread_options =
+	{
+		.name = "render",
+		.affinity_mask = thread_get_dedicated_core_mask(k_thread_core_render),
+		.priority = k_thread_priority_above_normal,
+	};
+	render->thread = thread_create_with_options(render_thread_func, render, &thread_options);
 	return render;
 }
 
 void render_destroy(render_t* render)
 {
-	queue_push(render->queue, NULL);
+	command_type_t* command = spsc_ring_reserve(render->ring, sizeof(command_type_t));
+	*command = k_command_quit;
+	spsc_ring_commit(render->ring);
 	thread_destroy(render->thread);
+	semaphore_destroy(render->frames_available);
+	spsc_ring_destroy(render->ring);
 	heap_free(render->heap, render);
 }
 
 void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform)
 {
-	model_command_t* command = heap_alloc(render->heap, sizeof(model_command_t), 8);
+	model_command_t* command = spsc_ring_reserve(render->ring, sizeof(model_command_t) + uniform->size);
 	command->type = k_command_model;
 	command->entity = *entity;
 	command->mesh = mesh;
 	command->shader = shader;
 	command->uniform_buffer.size = uniform->size;
-	command->uniform_buffer.data = heap_alloc(render->heap, uniform->size, 8);
+	command->uniform_buffer.data = command + 1;
 	memcpy(command->uniform_buffer.data, uniform->data, uniform->size);
-	queue_push(render->queue, command);
+	spsc_ring_commit(render->ring);
 }
 
 void render_push_done(render_t* render)
 {
-	frame_done_command_t* command = heap_alloc(render->heap, sizeof(frame_done_command_t), 8); //when does this get freed?
+	// Keep the game from running more than a couple of frames ahead of the render thread.
+	semaphore_aquire(render->frames_available);
+
+	frame_done_command_t* command = spsc_ring_reserve(render->ring, sizeof(frame_done_command_t));
 	command->type = k_command_frame_done;
-	queue_push(render->queue, command);
+	spsc_ring_commit(render->ring);
 }
 
 static int render_thread_func(void* user)
@@ -138,9 +158,10 @@ static int render_thread_func(void* user)
 
 	while (true)
 	{
-		command_type_t* type = queue_pop(render->queue);
-		if (!type)
+		command_type_t* type = spsc_ring_acquire(render->ring, NULL);
+		if (*type == k_command_quit)
 		{
+			spsc_ring_release(render->ring);
 			break;
 		}
 
@@ -159,6 +180,8 @@ static int render_thread_func(void* user)
 			destroy_stale_data(render);
 			++render->frame_counter;
 			frame_index = render->frame_counter % render->gpu_frame_count;
+
+			semaphore_release(render->frames_available);
 		}
 		else if (*type == k_command_model)
 		{
@@ -167,8 +190,6 @@ static int render_thread_func(void* user)
 			draw_mesh_t* mesh = create_or_get_mesh_for_model_command(render, command);
 			draw_instance_t* instance = create_or_get_instance_for_model_command(render, command, shader->shader);
 
-			heap_free(render->heap, command->uniform_buffer.data);
-
 			if (last_pipeline != shader->pipeline)
 			{
 				gpu_cmd_pipeline_bind(render->gpu, cmdbuf, shader->pipeline);
@@ -183,7 +204,7 @@ static int render_thread_func(void* user)
 			gpu_cmd_draw(render->gpu, cmdbuf);
 		}
 
-		heap_free(render->heap, type);
+		spsc_ring_release(render->ring);
 	}
 
 	gpu_wait_until_idle(render->gpu);
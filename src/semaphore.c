@@ -1,25 +1,141 @@
 #include "semaphore.h"
 
+#include "atomic.h"
+#include "timer.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <malloc.h>
+
+#pragma comment(lib, "Synchronization.lib")
+
+enum
+{
+	k_semaphore_spin_count = 64,
+	k_semaphore_cache_line = 64,
+};
+
+// Counting semaphore in user space.
+// The count lives in one word that waiters sleep on with WaitOnAddress; the kernel is only
+// entered when a thread has to block or when releasing with a sleeper to wake.
+typedef struct semapthore_t
+{
+	int count;
+	int waiters;
+	int max_count;
+} semaphore_t;
 
 semaphore_t* semaphore_create(int initial_count, int max_count)
 {
-	HANDLE semaphore = CreateSemaphore(NULL, initial_count, max_count, NULL);
-	return (semaphore_t*) semaphore;
+	semaphore_t* semaphore = _aligned_malloc(sizeof(semaphore_t), k_semaphore_cache_line);
+	semaphore->count = initial_count;
+	semaphore->waiters = 0;
+	semaphore->max_count = max_count;
+	return semaphore;
 }
 
 void semaphore_destroy(semaphore_t* semaphore)
 {
-	CloseHandle(semaphore);
+	_aligned_free(semaphore);
+}
+
+static bool semaphore_try_aquire(semaphore_t* semaphore)
+{
+	int count = atomic_load_relaxed(&semaphore->count);
+	while (count > 0)
+	{
+		int prev = atomic_compare_and_exchange(&semaphore->count, count, count - 1);
+		if (prev == count)
+		{
+			return true;
+		}
+		count = prev;
+	}
+	return false;
+}
+
+// Milliseconds left before a deadline in timer ticks, or INFINITE for no deadline.
+static uint32_t semaphore_remaining_ms(uint64_t deadline)
+{
+	if (deadline == UINT64_MAX)
+	{
+		return INFINITE;
+	}
+	uint64_t now = timer_get_ticks();
+	if (now >= deadline)
+	{
+		return 0;
+	}
+	// Round up so a wait never ends before the deadline.
+	uint64_t ticks_per_second = timer_get_ticks_per_second();
+	return (uint32_t)(((deadline - now) * 1000 + ticks_per_second - 1) / ticks_per_second);
+}
+
+static bool semaphore_aquire_until(semaphore_t* semaphore, uint64_t deadline)
+{
+	for (int spins = 0; spins < k_semaphore_spin_count; ++spins)
+	{
+		if (semaphore_try_aquire(semaphore))
+		{
+			return true;
+		}
+		YieldProcessor();
+	}
+
+	// Register as a waiter before the final check, pairing with the release in
+	// semaphore_release, so a release between the check and the sleep is not lost.
+	atomic_increment(&semaphore->waiters);
+	bool acquired = false;
+	while (!(acquired = semaphore_try_aquire(semaphore)))
+	{
+		uint32_t remaining_ms = semaphore_remaining_ms(deadline);
+		if (remaining_ms == 0)
+		{
+			break;
+		}
+		int zero = 0;
+		WaitOnAddress(&semaphore->count, &zero, sizeof(int), remaining_ms);
+	}
+	atomic_decrement(&semaphore->waiters);
+	return acquired;
 }
 
 void semaphore_aquire(semaphore_t* semaphore)
 {
-	WaitForSingleObject(semaphore, INFINITE);
+	semaphore_aquire_until(semaphore, UINT64_MAX);
+}
+
+bool semaphore_aquire_timed(semaphore_t* semaphore, uint32_t timeout_ms)
+{
+	if (timeout_ms == INFINITE)
+	{
+		return semaphore_aquire_until(semaphore, UINT64_MAX);
+	}
+	uint64_t deadline = timer_get_ticks() + (uint64_t)timeout_ms * timer_get_ticks_per_second() / 1000;
+	return semaphore_aquire_until(semaphore, deadline);
 }
 
 void semaphore_release(semaphore_t* semaphore)
 {
-	ReleaseSemaphore(semaphore, 1, NULL);
+	int count = atomic_load_relaxed(&semaphore->count);
+	while (true)
+	{
+		if (count >= semaphore->max_count)
+		{
+			// Matches the kernel semaphore: releasing past the maximum is dropped.
+			return;
+		}
+		int prev = atomic_compare_and_exchange(&semaphore->count, count, count + 1);
+		if (prev == count)
+		{
+			break;
+		}
+		count = prev;
+	}
+	// The compare-exchange above is a full barrier, so a waiter either sees the new count
+	// or is already counted here.
+	if (atomic_load(&semaphore->waiters) > 0)
+	{
+		WakeByAddressSingle(&semaphore->count);
+	}
 }
@@ -1,4 +1,10 @@
+#pragma once
+
 //Conting semaphore thread synchronization
+//Lives in user space: acquiring an available count or releasing with no one waiting never enters the kernel.
+
+#include <stdbool.h>
+#include <stdint.h>
 
 //handle to a semathore
 typedef struct semapthore_t semaphore_t;
@@ -13,5 +19,9 @@ void semaphore_destroy(semaphore_t* semaphore);
 //if the count is zero, blocks until another thread releases
 void semaphore_aquire(semaphore_t* semaphore);
 
+//lowers the semaphore count by one, waiting at most timeout_ms for another thread to release
+//returns false if the wait timed out
+bool semaphore_aquire_timed(semaphore_t* semaphore, uint32_t timeout_ms);
+
 //raises the semaphore count by one
 void semaphore_release(semaphore_t* semaphore);
@@ -0,0 +1,229 @@
+#include "spsc_ring.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+#include "semaphore.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <assert.h>
+#include <stdbool.h>
+
+enum
+{
+	k_spsc_ring_cache_line = 64,
+	k_spsc_ring_alignment = 16,
+	k_spsc_ring_spin_count = 256,
+};
+
+// Precedes every command in the ring.
+// A record with payload_size < 0 pads out the end of the buffer so a command never wraps.
+typedef struct spsc_ring_header_t
+{
+	int record_size;
+	int payload_size;
+	int reserved[2];
+} spsc_ring_header_t;
+
+typedef struct spsc_ring_t
+{
+	heap_t* heap;
+	char* buffer;
+	int capacity;
+	int mask;
+	semaphore_t* data_available;
+	semaphore_t* space_available;
+	char shared_padding[k_spsc_ring_cache_line];
+
+	// Written by the producer, read by the consumer.
+	int write_index;
+	int consumer_waiting;
+	char write_padding[k_spsc_ring_cache_line - 2 * sizeof(int)];
+
+	// Written by the consumer, read by the producer.
+	int read_index;
+	int producer_waiting;
+	char read_padding[k_spsc_ring_cache_line - 2 * sizeof(int)];
+
+	// Producer private.
+	int producer_write;
+	int producer_commit;
+	int producer_cached_read;
+	char producer_padding[k_spsc_ring_cache_line - 3 * sizeof(int)];
+
+	// Consumer private.
+	int consumer_read;
+	int consumer_release;
+	int consumer_cached_write;
+	char consumer_padding[k_spsc_ring_cache_line - 3 * sizeof(int)];
+} spsc_ring_t;
+
+// Positions are free-running ints; compare them by signed distance so wrapping is harmless.
+static int spsc_ring_distance(int a, int b)
+{
+	return (int)((unsigned int)a - (unsigned int)b);
+}
+
+static int spsc_ring_advance(int position, int offset)
+{
+	return (int)((unsigned int)position + (unsigned int)offset);
+}
+
+// Block until flag-guarded data is ready. is_ready is re-evaluated after announcing the wait,
+// pairing with spsc_ring_wake, so a wake-up between the check and the sleep is not lost.
+static void spsc_ring_wait(int* waiting, semaphore_t* semaphore, bool (*is_ready)(spsc_ring_t*), spsc_ring_t* ring)
+{
+	for (int spins = 0; spins < k_spsc_ring_spin_count; ++spins)
+	{
+		if (is_ready(ring))
+		{
+			return;
+		}
+		YieldProcessor();
+	}
+	while (!is_ready(ring))
+	{
+		atomic_exchange(waiting, 1);
+		if (is_ready(ring))
+		{
+			atomic_store_release(waiting, 0);
+			return;
+		}
+		semaphore_aquire(semaphore);
+		atomic_store_release(waiting, 0);
+	}
+}
+
+static void spsc_ring_wake(int* waiting, semaphore_t* semaphore)
+{
+	// Full barrier between publishing the new index and checking for a sleeper.
+	if (atomic_compare_and_exchange(waiting, 0, 0) != 0)
+	{
+		semaphore_release(semaphore);
+	}
+}
+
+static int spsc_ring_align(size_t size)
+{
+	return (int)((size + (k_spsc_ring_alignment - 1)) & ~(size_t)(k_spsc_ring_alignment - 1));
+}
+
+spsc_ring_t* spsc_ring_create(heap_t* heap, size_t capacity)
+{
+	int rounded = k_spsc_ring_cache_line;
+	while ((size_t)rounded < capacity)
+	{
+		rounded <<= 1;
+	}
+
+	spsc_ring_t* ring = heap_alloc(heap, sizeof(spsc_ring_t), k_spsc_ring_cache_line);
+	ring->heap = heap;
+	ring->buffer = heap_alloc(heap, rounded, k_spsc_ring_cache_line);
+	ring->capacity = rounded;
+	ring->mask = rounded - 1;
+	ring->data_available = semaphore_create(0, 1);
+	ring->space_available = semaphore_create(0, 1);
+	ring->write_index = 0;
+	ring->consumer_waiting = 0;
+	ring->read_index = 0;
+	ring->producer_waiting = 0;
+	ring->producer_write = 0;
+	ring->producer_commit = 0;
+	ring->producer_cached_read = 0;
+	ring->consumer_read = 0;
+	ring->consumer_release = 0;
+	ring->consumer_cached_write = 0;
+	return ring;
+}
+
+void spsc_ring_destroy(spsc_ring_t* ring)
+{
+	semaphore_destroy(ring->data_available);
+	semaphore_destroy(ring->space_available);
+	heap_free(ring->heap, ring->buffer);
+	heap_free(ring->heap, ring);
+}
+
+static bool spsc_ring_has_space(spsc_ring_t* ring)
+{
+	ring->producer_cached_read = atomic_load_acquire(&ring->read_index);
+	return spsc_ring_distance(ring->producer_commit, ring->producer_cached_read) <= ring->capacity;
+}
+
+void* spsc_ring_reserve(spsc_ring_t* ring, size_t size)
+{
+	int record_size = spsc_ring_align(sizeof(spsc_ring_header_t) + size);
+	assert(record_size <= ring->capacity / 2);
+
+	int write = ring->producer_write;
+	int contiguous = ring->capacity - (write & ring->mask);
+	int needed = contiguous < record_size ? contiguous + record_size : record_size;
+
+	// The consumer only ever frees space, so a stale read index errs on the side of waiting.
+	ring->producer_commit = spsc_ring_advance(write, needed);
+	if (spsc_ring_distance(ring->producer_commit, ring->producer_cached_read) > ring->capacity)
+	{
+		spsc_ring_wait(&ring->producer_waiting, ring->space_available, spsc_ring_has_space, ring);
+	}
+
+	if (contiguous < record_size)
+	{
+		spsc_ring_header_t* padding = (spsc_ring_header_t*)&ring->buffer[write & ring->mask];
+		padding->record_size = contiguous;
+		padding->payload_size = -1;
+		write = spsc_ring_advance(write, contiguous);
+	}
+
+	spsc_ring_header_t* header = (spsc_ring_header_t*)&ring->buffer[write & ring->mask];
+	header->record_size = record_size;
+	header->payload_size = (int)size;
+	return header + 1;
+}
+
+void spsc_ring_commit(spsc_ring_t* ring)
+{
+	ring->producer_write = ring->producer_commit;
+	atomic_store_release(&ring->write_index, ring->producer_write);
+	spsc_ring_wake(&ring->consumer_waiting, ring->data_available);
+}
+
+static bool spsc_ring_has_data(spsc_ring_t* ring)
+{
+	ring->consumer_cached_write = atomic_load_acquire(&ring->write_index);
+	return ring->consumer_read != ring->consumer_cached_write;
+}
+
+void* spsc_ring_acquire(spsc_ring_t* ring, size_t* size)
+{
+	while (true)
+	{
+		if (ring->consumer_read == ring->consumer_cached_write)
+		{
+			spsc_ring_wait(&ring->consumer_waiting, ring->data_available, spsc_ring_has_data, ring);
+		}
+
+		spsc_ring_header_t* header = (spsc_ring_header_t*)&ring->buffer[ring->consumer_read & ring->mask];
+		if (header->payload_size < 0)
+		{
+			// Padding always travels with the command after it, so skipping it cannot run past write_index.
+			ring->consumer_read = spsc_ring_advance(ring->consumer_read, header->record_size);
+			continue;
+		}
+
+		ring->consumer_release = spsc_ring_advance(ring->consumer_read, header->record_size);
+		if (size)
+		{
+			*size = (size_t)header->payload_size;
+		}
+		return header + 1;
+	}
+}
+
+void spsc_ring_release(spsc_ring_t* ring)
+{
+	ring->consumer_read = ring->consumer_release;
+	atomic_store_release(&ring->read_index, ring->consumer_read);
+	spsc_ring_wake(&ring->producer_waiting, ring->space_available);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Single-producer single-consumer ring of variable-size commands.
+//
+// One thread writes commands and one thread reads them, in order.
+// Commands are built in place: the producer reserves space, fills it and then commits it,
+// so nothing is allocated or copied per command. Read and write positions live on separate
+// cache lines; the only shared traffic per command is one store and, occasionally, one load.
+
+#include <stddef.h>
+
+// Handle to a command ring.
+typedef struct spsc_ring_t spsc_ring_t;
+
+typedef struct heap_t heap_t;
+
+// Create a command ring holding up to capacity bytes of commands.
+// Capacity is rounded up to the next power of two.
+spsc_ring_t* spsc_ring_create(heap_t* heap, size_t capacity);
+
+// Destroy a previously created command ring.
+void spsc_ring_destroy(spsc_ring_t* ring);
+
+// Reserve size bytes for a new command and return where to build it.
+// Memory is 16-byte aligned. Blocks while the ring is too full.
+// Producer thread only. Must be followed by spsc_ring_commit before the next reserve.
+void* spsc_ring_reserve(spsc_ring_t* ring, size_t size);
+
+// Make the most recently reserved command visible to the consumer.
+void spsc_ring_commit(spsc_ring_t* ring);
+
+// Get the oldest command in the ring and, optionally, its size.
+// Blocks until a command is available.
+// Consumer thread only. Memory stays valid until spsc_ring_release is called.
+void* spsc_ring_acquire(spsc_ring_t* ring, size_t* size);
+
+// Return the space used by the most recently acquired command to the producer.
+void spsc_ring_release(spsc_ring_t* ring);
@@ -0,0 +1,580 @@
+#include "task.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "queue.h"
+#include "semaphore.h"
+#include "thread.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct task_executor_t task_executor_t;
+
+enum
+{
+	k_task_max_workers = 64,
+	k_task_default_fiber_count = 128,
+	k_task_capacity = 4096,
+	k_task_fiber_stack_size = 64 * 1024,
+	k_task_idle_spin_count = 256,
+	k_task_poll_interval_ms = 1,
+	k_task_cache_line = 64,
+};
+
+typedef struct task_counter_t
+{
+	task_executor_t* executor;
+	int value;
+} task_counter_t;
+
+typedef struct task_t
+{
+	task_func_t func;
+	void* data;
+	task_counter_t* counter;
+} task_t;
+
+typedef struct task_fiber_t
+{
+	task_executor_t* executor;
+	void* fiber;
+	task_t task;
+	// Condition the fiber is parked on.
+	task_wait_func_t wait_func;
+	void* wait_data;
+} task_fiber_t;
+
+// Every queue below is sized to hold all of its items at once. They are still pushed with the
+// blocking queue_push: a try-push can report full for an instant while a concurrent pop of the
+// same cell finishes, and a fiber or task slot dropped that way would be lost for good.
+
+// What a fiber asked its worker to do with it after switching back to the scheduler.
+// Handled by the scheduler, not the fiber, so no other worker can resume the fiber
+// before it has fully switched out.
+typedef enum task_fiber_action_t
+{
+	k_task_fiber_none,
+	k_task_fiber_park,
+	k_task_fiber_release,
+} task_fiber_action_t;
+
+typedef struct task_worker_t
+{
+	task_executor_t* executor;
+	thread_t* thread;
+	int index;
+	void* scheduler_fiber;
+	task_fiber_t* current;
+	task_fiber_t* pending;
+	task_fiber_action_t pending_action;
+} task_worker_t;
+
+typedef struct task_executor_t
+{
+	heap_t* heap;
+	int worker_count;
+	int fiber_count;
+
+	__declspec(align(64)) int quit;
+	// Tasks queued or in flight; workers only exit once this drains.
+	int active_tasks;
+	__declspec(align(64)) int sleeping_workers;
+	// Bumped by every wake, so a worker about to sleep can tell it missed one.
+	int wake_sequence;
+	// Parked fibers whose condition nobody signals; while any exist, sleeping workers poll.
+	int polled_waits;
+	semaphore_t* wake;
+
+	queue_t* ready_tasks;
+	queue_t* free_tasks;
+	queue_t* free_fibers;
+	queue_t* parked_fibers;
+
+	task_t* tasks;
+	task_fiber_t* fibers;
+	task_worker_t* workers[k_task_max_workers];
+} task_executor_t;
+
+// Worker owned by the calling thread, if any.
+static __declspec(thread) task_worker_t* s_task_worker = NULL;
+
+// A fiber can resume on a different thread than it parked on, so the thread-local worker must
+// be re-read after every switch rather than cached across it by the optimizer.
+static __declspec(noinline) task_worker_t* task_get_worker()
+{
+	return *(task_worker_t* volatile*)&s_task_worker;
+}
+
+static void task_wake_worker(task_executor_t* executor)
+{
+	// The increment is a full barrier, so a worker about to sleep either sees the new
+	// sequence or is counted here.
+	atomic_increment(&executor->wake_sequence);
+	if (atomic_load(&executor->sleeping_workers) != 0)
+	{
+		semaphore_release(executor->wake);
+	}
+}
+
+static void task_counter_decrement(task_counter_t* counter)
+{
+	// The last decrement may release a parked waiter.
+	if (atomic_decrement(&counter->value) == 1)
+	{
+		task_wake_worker(counter->executor);
+	}
+}
+
+static void task_finish(task_executor_t* executor, task_counter_t* counter)
+{
+	if (counter)
+	{
+		task_counter_decrement(counter);
+	}
+	if (atomic_decrement(&executor->active_tasks) == 1 && atomic_load(&executor->quit))
+	{
+		for (int i = 0; i < executor->worker_count; ++i)
+		{
+			semaphore_release(executor->wake);
+		}
+	}
+}
+
+// Switch from a task fiber back to its worker's scheduler, asking it to park or release us.
+static void task_switch_to_scheduler(task_fiber_t* fiber, task_fiber_action_t action)
+{
+	task_worker_t* worker = task_get_worker();
+	worker->pending = fiber;
+	worker->pending_action = action;
+	SwitchToFiber(worker->scheduler_fiber);
+}
+
+static void WINAPI task_fiber_func(void* user)
+{
+	task_fiber_t* fiber = user;
+	while (true)
+	{
+		task_t task = fiber->task;
+		task.func(task.data);
+		task_finish(fiber->executor, task.counter);
+		task_switch_to_scheduler(fiber, k_task_fiber_release);
+	}
+}
+
+// Run a fiber on this worker until it finishes its task or parks.
+static void task_resume(task_worker_t* worker, task_fiber_t* fiber)
+{
+	worker->current = fiber;
+	SwitchToFiber(fiber->fiber);
+	worker->current = NULL;
+
+	task_executor_t* executor = worker->executor;
+	if (worker->pending_action == k_task_fiber_park)
+	{
+		queue_push(executor->parked_fibers, worker->pending);
+	}
+	else if (worker->pending_action == k_task_fiber_release)
+	{
+		queue_push(executor->free_fibers, worker->pending);
+	}
+	worker->pending = NULL;
+	worker->pending_action = k_task_fiber_none;
+}
+
+// Resume one parked fiber whose condition now holds. Each parked fiber is checked at most once.
+static bool task_resume_parked(task_worker_t* worker)
+{
+	task_executor_t* executor = worker->executor;
+	void* item = NULL;
+	if (!queue_try_pop(executor->parked_fibers, &item))
+	{
+		return false;
+	}
+	task_fiber_t* fiber = item;
+	if (fiber->wait_func(fiber->wait_data))
+	{
+		task_resume(worker, fiber);
+		return true;
+	}
+	queue_push(executor->parked_fibers, fiber);
+	return false;
+}
+
+// Check every parked fiber once, resuming the first whose condition holds.
+static bool task_resume_any_parked(task_worker_t* worker)
+{
+	for (int i = 0; i < worker->executor->fiber_count; ++i)
+	{
+		if (task_resume_parked(worker))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool task_start_ready(task_worker_t* worker)
+{
+	task_executor_t* executor = worker->executor;
+	void* item = NULL;
+	if (!queue_try_pop(executor->free_fibers, &item))
+	{
+		// Every fiber is running or parked; new tasks wait until one frees up.
+		return false;
+	}
+	task_fiber_t* fiber = item;
+
+	void* task_item = NULL;
+	if (!queue_try_pop(executor->ready_tasks, &task_item))
+	{
+		queue_push(executor->free_fibers, fiber);
+		return false;
+	}
+	task_t* task = task_item;
+	fiber->task = *task;
+	queue_push(executor->free_tasks, task);
+
+	task_resume(worker, fiber);
+	return true;
+}
+
+static int task_worker_thread_func(void* user)
+{
+	task_worker_t* worker = user;
+	task_executor_t* executor = worker->executor;
+	s_task_worker = worker;
+	worker->scheduler_fiber = ConvertThreadToFiber(worker);
+
+	int idle_spins = 0;
+	while (true)
+	{
+		bool resumed = task_resume_parked(worker);
+		bool started = task_start_ready(worker);
+		if (resumed || started)
+		{
+			idle_spins = 0;
+			continue;
+		}
+
+		if (atomic_load(&executor->quit) && atomic_load(&executor->active_tasks) == 0)
+		{
+			break;
+		}
+
+		if (++idle_spins < k_task_idle_spin_count)
+		{
+			YieldProcessor();
+			continue;
+		}
+		idle_spins = 0;
+
+		// Counters and fs callbacks wake a worker when a parked fiber's condition comes true,
+		// so only sleep once every parked fiber has been checked since the last wake.
+		int wake_sequence = atomic_load_acquire(&executor->wake_sequence);
+		if (task_resume_any_parked(worker) || task_start_ready(worker))
+		{
+			continue;
+		}
+		atomic_increment(&executor->sleeping_workers);
+		if (atomic_load(&executor->wake_sequence) != wake_sequence)
+		{
+			// Woken while checking; look again.
+		}
+		else if (atomic_load(&executor->polled_waits) > 0)
+		{
+			semaphore_aquire_timed(executor->wake, k_task_poll_interval_ms);
+		}
+		else if (!atomic_load(&executor->quit) || atomic_load(&executor->active_tasks) > 0)
+		{
+			semaphore_aquire(executor->wake);
+		}
+		atomic_decrement(&executor->sleeping_workers);
+	}
+
+	ConvertFiberToThread();
+	s_task_worker = NULL;
+	return 0;
+}
+
+static int task_count_cores(uint64_t core_mask)
+{
+	int count = 0;
+	for (; core_mask; core_mask &= core_mask - 1)
+	{
+		++count;
+	}
+	return count;
+}
+
+task_executor_t* task_executor_create(heap_t* heap, int worker_count, int fiber_count)
+{
+	uint64_t core_mask = thread_get_worker_core_mask();
+	if (worker_count <= 0)
+	{
+		worker_count = task_count_cores(core_mask);
+		if (worker_count <= 0)
+		{
+			worker_count = thread_get_core_count();
+		}
+	}
+	if (worker_count > k_task_max_workers)
+	{
+		worker_count = k_task_max_workers;
+	}
+	if (fiber_count <= 0)
+	{
+		fiber_count = k_task_default_fiber_count;
+	}
+
+	task_executor_t* executor = heap_alloc(heap, sizeof(task_executor_t), k_task_cache_line);
+	executor->heap = heap;
+	executor->worker_count = worker_count;
+	executor->fiber_count = fiber_count;
+	executor->quit = 0;
+	executor->active_tasks = 0;
+	executor->sleeping_workers = 0;
+	executor->wake_sequence = 0;
+	executor->polled_waits = 0;
+	executor->wake = semaphore_create(0, worker_count);
+
+	executor->ready_tasks = queue_create(heap, k_task_capacity);
+	executor->free_tasks = queue_create(heap, k_task_capacity);
+	executor->free_fibers = queue_create(heap, fiber_count);
+	executor->parked_fibers = queue_create(heap, fiber_count);
+
+	executor->tasks = heap_alloc(heap, sizeof(task_t) * k_task_capacity, 8);
+	for (int i = 0; i < k_task_capacity; ++i)
+	{
+		queue_push(executor->free_tasks, &executor->tasks[i]);
+	}
+
+	executor->fibers = heap_alloc(heap, sizeof(task_fiber_t) * fiber_count, 8);
+	for (int i = 0; i < fiber_count; ++i)
+	{
+		task_fiber_t* fiber = &executor->fibers[i];
+		fiber->executor = executor;
+		fiber->wait_func = NULL;
+		fiber->wait_data = NULL;
+		fiber->fiber = CreateFiber(k_task_fiber_stack_size, task_fiber_func, fiber);
+		if (!fiber->fiber)
+		{
+			debug_print(k_print_error, "Task fiber failed to create\n");
+			continue;
+		}
+		queue_push(executor->free_fibers, fiber);
+	}
+
+	for (int i = 0; i < worker_count; ++i)
+	{
+		task_worker_t* worker = heap_alloc(heap, sizeof(task_worker_t), k_task_cache_line);
+		worker->executor = executor;
+		worker->index = i;
+		worker->scheduler_fiber = NULL;
+		worker->current = NULL;
+		worker->pending = NULL;
+		worker->pending_action = k_task_fiber_none;
+		executor->workers[i] = worker;
+
+		char name[k_thread_name_max];
+		sprintf_s(name, sizeof(name), "task worker %d", i);
+		thread_options_t options = { .name = name, .affinity_mask = core_mask, .priority = k_thread_priority_normal };
+		worker->thread = thread_create_with_options(task_worker_thread_func, worker, &options);
+	}
+
+	return executor;
+}
+
+void task_executor_destroy(task_executor_t* executor)
+{
+	atomic_store(&executor->quit, 1);
+	for (int i = 0; i < executor->worker_count; ++i)
+	{
+		semaphore_release(executor->wake);
+	}
+	for (int i = 0; i < executor->worker_count; ++i)
+	{
+		thread_destroy(executor->workers[i]->thread);
+		heap_free(executor->heap, executor->workers[i]);
+	}
+
+	for (int i = 0; i < executor->fiber_count; ++i)
+	{
+		if (executor->fibers[i].fiber)
+		{
+			DeleteFiber(executor->fibers[i].fiber);
+		}
+	}
+	heap_free(executor->heap, executor->fibers);
+	heap_free(executor->heap, executor->tasks);
+
+	queue_destroy(executor->parked_fibers);
+	queue_destroy(executor->free_fibers);
+	queue_destroy(executor->free_tasks);
+	queue_destroy(executor->ready_tasks);
+	semaphore_destroy(executor->wake);
+	heap_free(executor->heap, executor);
+}
+
+void task_run(task_executor_t* executor, task_func_t func, void* data, task_counter_t* counter)
+{
+	if (counter)
+	{
+		atomic_increment(&counter->value);
+	}
+	atomic_increment(&executor->active_tasks);
+
+	void* item = NULL;
+	if (!queue_try_pop(executor->free_tasks, &item))
+	{
+		// Out of task slots; doing the work now is better than dropping it or blocking.
+		func(data);
+		task_finish(executor, counter);
+		return;
+	}
+
+	task_t* task = item;
+	task->func = func;
+	task->data = data;
+	task->counter = counter;
+	// Never blocks for long: the ready queue holds as many entries as there are task slots.
+	queue_push(executor->ready_tasks, task);
+	task_wake_worker(executor);
+}
+
+task_counter_t* task_counter_create(task_executor_t* executor)
+{
+	task_counter_t* counter = heap_alloc(executor->heap, sizeof(task_counter_t), 8);
+	counter->executor = executor;
+	counter->value = 0;
+	return counter;
+}
+
+void task_counter_destroy(task_executor_t* executor, task_counter_t* counter)
+{
+	heap_free(executor->heap, counter);
+}
+
+bool task_counter_is_done(task_counter_t* counter)
+{
+	return atomic_load_acquire(&counter->value) == 0;
+}
+
+static bool task_counter_wait_func(void* data)
+{
+	return task_counter_is_done(data);
+}
+
+void task_counter_add_fs_work(task_counter_t* counter)
+{
+	atomic_increment(&counter->value);
+}
+
+void task_fs_work_callback(fs_work_t* work, void* counter)
+{
+	task_counter_decrement(counter);
+}
+
+// Run a ready task on the waiting fiber when every fiber is taken. Otherwise a wait on tasks
+// that cannot start, because all fibers are parked in waits like this one, never finishes.
+static bool task_run_ready_inline(task_executor_t* executor)
+{
+	void* item = NULL;
+	if (queue_try_pop(executor->free_fibers, &item))
+	{
+		// A worker can start the ready tasks on it.
+		queue_push(executor->free_fibers, item);
+		return false;
+	}
+	if (!queue_try_pop(executor->ready_tasks, &item))
+	{
+		return false;
+	}
+	task_t task = *(task_t*)item;
+	queue_push(executor->free_tasks, item);
+	task.func(task.data);
+	task_finish(executor, task.counter);
+	return true;
+}
+
+static void task_wait(task_executor_t* executor, task_wait_func_t is_done, void* data, bool polled)
+{
+	if (is_done(data))
+	{
+		return;
+	}
+
+	task_worker_t* worker = task_get_worker();
+	if (!worker || worker->executor != executor || !worker->current)
+	{
+		// Not on one of our fibers; nothing to switch to, so poll.
+		for (int spins = 0; !is_done(data); ++spins)
+		{
+			if (spins < k_task_idle_spin_count)
+			{
+				YieldProcessor();
+			}
+			else
+			{
+				thread_sleep(spins < 2 * k_task_idle_spin_count ? 0 : k_task_poll_interval_ms);
+			}
+		}
+		return;
+	}
+
+	while (task_run_ready_inline(executor))
+	{
+		if (is_done(data))
+		{
+			return;
+		}
+	}
+
+	// Inline tasks may have parked and resumed this fiber on another worker.
+	task_fiber_t* fiber = task_get_worker()->current;
+	fiber->wait_func = is_done;
+	fiber->wait_data = data;
+	if (polled)
+	{
+		atomic_increment(&executor->polled_waits);
+	}
+	task_switch_to_scheduler(fiber, k_task_fiber_park);
+	// Resumed, possibly on another worker, once is_done(data) returned true.
+	if (polled)
+	{
+		atomic_decrement(&executor->polled_waits);
+	}
+	fiber->wait_func = NULL;
+	fiber->wait_data = NULL;
+}
+
+void task_counter_wait(task_executor_t* executor, task_counter_t* counter)
+{
+	task_wait(executor, task_counter_wait_func, counter, false);
+}
+
+static bool task_fs_work_wait_func(void* data)
+{
+	return fs_work_is_done(data);
+}
+
+void task_wait_fs_work(task_executor_t* executor, fs_work_t* work)
+{
+	task_wait(executor, task_fs_work_wait_func, work, true);
+}
+
+void task_wait_until(task_executor_t* executor, task_wait_func_t is_done, void* data)
+{
+	task_wait(executor, is_done, data, true);
+}
+
+bool task_is_running_in_task(task_executor_t* executor)
+{
+	task_worker_t* worker = task_get_worker();
+	return worker && worker->executor == executor && worker->current;
+}
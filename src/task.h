@@ -0,0 +1,83 @@
+#pragma once
+
+// Fiber-based task executor
+//
+// Tasks run on fibers spread over a small set of worker threads. When a task waits (on a
+// counter, an fs operation or any other condition) its fiber is parked and the worker
+// thread moves straight on to other tasks; the parked fiber is resumed, possibly on a
+// different worker, once the condition holds. Waiting never ties up an OS thread, so frame
+// work that depends on I/O can keep every core busy.
+//
+// Unlike the job system, the thread that creates the executor is not a worker. Waiting from
+// outside a task is allowed but simply polls.
+//
+// A parked task keeps its fiber. When every fiber is taken, a waiting task runs ready tasks
+// itself, on its own fiber, before parking; otherwise waits nested as deep as fiber_count on
+// tasks that have not started would never finish. Those tasks share the waiting fiber's stack.
+
+#include <stdbool.h>
+
+// Handle to a task executor.
+typedef struct task_executor_t task_executor_t;
+
+// Handle to a task completion counter.
+typedef struct task_counter_t task_counter_t;
+
+typedef struct fs_work_t fs_work_t;
+typedef struct heap_t heap_t;
+
+// Function run by a task.
+typedef void (*task_func_t)(void* data);
+
+// Condition polled for a parked task. Must be cheap and safe to call from any worker.
+typedef bool (*task_wait_func_t)(void* data);
+
+// Create a task executor.
+// If worker_count is zero or less, one worker is created per job worker core.
+// fiber_count bounds how many tasks can be in flight (running or parked) at once;
+// zero or less picks a default.
+task_executor_t* task_executor_create(heap_t* heap, int worker_count, int fiber_count);
+
+// Destroy a previously created task executor.
+// Tasks still queued or parked are finished before the workers exit.
+void task_executor_destroy(task_executor_t* executor);
+
+// Queue a task. If counter is not NULL it is incremented now and decremented when the task finishes.
+// Safe to call from any thread. If the executor is out of task slots the task runs immediately
+// on the calling thread.
+void task_run(task_executor_t* executor, task_func_t func, void* data, task_counter_t* counter);
+
+// Create a counter that tracks completion of a group of tasks.
+task_counter_t* task_counter_create(task_executor_t* executor);
+
+// Destroy a counter. All tasks using it must have finished.
+void task_counter_destroy(task_executor_t* executor, task_counter_t* counter);
+
+// Determine if all tasks tracked by a counter have finished.
+bool task_counter_is_done(task_counter_t* counter);
+
+// Wait until all tasks and fs work tracked by a counter have finished.
+// Inside a task the fiber is parked instead of blocking the worker, and resumed as soon as the
+// counter reaches zero.
+void task_counter_wait(task_executor_t* executor, task_counter_t* counter);
+
+// Track an fs read or write with a counter. Call before queuing the work, and queue it with
+// task_fs_work_callback as its callback and the counter as its callback_data.
+void task_counter_add_fs_work(task_counter_t* counter);
+
+// fs completion callback for work tracked with task_counter_add_fs_work. Any dispatch works;
+// k_fs_callback_immediate resumes the waiting task soonest.
+void task_fs_work_callback(fs_work_t* work, void* counter);
+
+// Wait until an fs read or write completes.
+// Inside a task the fiber is parked instead of blocking the worker. Nothing signals the
+// executor when the work completes, so the workers poll for it; for work queued with a
+// callback, track it with task_counter_add_fs_work and wait on the counter instead.
+void task_wait_fs_work(task_executor_t* executor, fs_work_t* work);
+
+// Wait until is_done(data) returns true, e.g. for a GPU fence or any other external event.
+// Inside a task the fiber is parked and the condition is polled by the workers.
+void task_wait_until(task_executor_t* executor, task_wait_func_t is_done, void* data);
+
+// Determine if the calling code is running inside a task of the given executor.
+bool task_is_running_in_task(task_executor_t* executor);
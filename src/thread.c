@@ -1,31 +1,173 @@
 #include "thread.h"
 
 #include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
-typedef struct thread_t thread_t;
+
+typedef struct thread_t
+{
+	HANDLE handle;
+	int (*func) (void*);
+	void* data;
+	char name[k_thread_name_max];
+} thread_t;
+
+static __declspec(thread) char s_thread_name[k_thread_name_max];
+
+static DWORD WINAPI thread_start(void* user)
+{
+	thread_t* thread = user;
+	strcpy_s(s_thread_name, sizeof(s_thread_name), thread->name);
+	return thread->func(thread->data);
+}
+
+static void thread_set_description(HANDLE handle, const char* name)
+{
+	// Visible in the debugger's thread list and in minidumps.
+	wchar_t wide_name[k_thread_name_max];
+	if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, k_thread_name_max) > 0)
+	{
+		SetThreadDescription(handle, wide_name);
+	}
+}
 
 thread_t* thread_create(int (*func) (void*), void* data)
 {
-	HANDLE h = CreateThread(NULL, 0, func, data, CREATE_SUSPENDED, NULL);
-	if(h == INVALID_HANDLE_VALUE)
+	return thread_create_with_options(func, data, NULL);
+}
+
+thread_t* thread_create_with_options(int (*func) (void*), void* data, const thread_options_t* options)
+{
+	// Not allocated from heap_t: threads are created before and outlive most heaps.
+	thread_t* thread = calloc(1, sizeof(thread_t));
+	thread->func = func;
+	thread->data = data;
+	if (options && options->name)
+	{
+		strncpy_s(thread->name, sizeof(thread->name), options->name, _TRUNCATE);
+	}
+
+	thread->handle = CreateThread(NULL, 0, thread_start, thread, CREATE_SUSPENDED, NULL);
+	if (thread->handle == NULL)
 	{
 		debug_print(k_print_warning, "Thread failed to create\n");
+		free(thread);
 		return NULL;
 	}
-	ResumeThread(h);
-	return (thread_t*)h;
+
+	if (options)
+	{
+		if (options->name)
+		{
+			thread_set_description(thread->handle, thread->name);
+		}
+		if (options->affinity_mask && !SetThreadAffinityMask(thread->handle, (DWORD_PTR)options->affinity_mask))
+		{
+			debug_print(k_print_warning, "Thread '%s' failed to set affinity mask 0x%llx\n", thread->name, options->affinity_mask);
+		}
+		if (options->priority != k_thread_priority_normal && !SetThreadPriority(thread->handle, options->priority))
+		{
+			debug_print(k_print_warning, "Thread '%s' failed to set priority %d\n", thread->name, options->priority);
+		}
+	}
+
+	ResumeThread(thread->handle);
+	return thread;
 }
 
 int thread_destroy(thread_t* thread)
 {
-	WaitForSingleObject(thread, INFINITE);
-	int exit = 0;
-	GetExitCodeThread(thread, &exit);
-	CloseHandle(thread);
-	return exit;
+	WaitForSingleObject(thread->handle, INFINITE);
+	DWORD exit = 0;
+	GetExitCodeThread(thread->handle, &exit);
+	CloseHandle(thread->handle);
+	free(thread);
+	return (int)exit;
 }
 
 void thread_sleep(uint32_t ms)
 {
 	Sleep(ms);
 }
+
+int thread_get_core_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+void thread_set_name(const char* name)
+{
+	strncpy_s(s_thread_name, sizeof(s_thread_name), name, _TRUNCATE);
+	thread_set_description(GetCurrentThread(), s_thread_name);
+}
+
+const char* thread_get_name()
+{
+	return s_thread_name;
+}
+
+uint64_t thread_get_process_core_mask()
+{
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+	{
+		return 0;
+	}
+	return (uint64_t)process_mask;
+}
+
+// Dedicated cores are taken from the top of the process mask, one per slot.
+// Only done when at least two cores remain for the job workers.
+static uint64_t thread_get_dedicated_cores()
+{
+	uint64_t process_mask = thread_get_process_core_mask();
+	int core_count = 0;
+	for (uint64_t mask = process_mask; mask; mask &= mask - 1)
+	{
+		++core_count;
+	}
+	if (core_count < k_thread_dedicated_core_count + 2)
+	{
+		return 0;
+	}
+
+	uint64_t dedicated = 0;
+	for (int bit = 63, taken = 0; bit >= 0 && taken < k_thread_dedicated_core_count; --bit)
+	{
+		if (process_mask & (1ull << bit))
+		{
+			dedicated |= 1ull << bit;
+			++taken;
+		}
+	}
+	return dedicated;
+}
+
+uint64_t thread_get_dedicated_core_mask(thread_dedicated_core_t core)
+{
+	uint64_t dedicated = thread_get_dedicated_cores();
+	// Slot zero is the highest dedicated core.
+	for (int bit = 63, slot = 0; bit >= 0; --bit)
+	{
+		if (dedicated & (1ull << bit))
+		{
+			if (slot++ == (int)core)
+			{
+				return 1ull << bit;
+			}
+		}
+	}
+	return 0;
+}
+
+uint64_t thread_get_worker_core_mask()
+{
+	return thread_get_process_core_mask() & ~thread_get_dedicated_cores();
+}
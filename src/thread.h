@@ -7,13 +7,74 @@
 // Handle to a thread.
 typedef struct thread_t thread_t;
 
+// Scheduling priority of a thread, relative to the process priority class.
+typedef enum thread_priority_t
+{
+	k_thread_priority_lowest = -2,
+	k_thread_priority_below_normal = -1,
+	k_thread_priority_normal = 0,
+	k_thread_priority_above_normal = 1,
+	k_thread_priority_highest = 2,
+	k_thread_priority_time_critical = 15,
+} thread_priority_t;
+
+// Cores set aside for long-lived dedicated threads.
+// Job workers stay off these so the dedicated threads neither share caches with them nor get
+// migrated mid-frame. See thread_get_dedicated_core_mask().
+typedef enum thread_dedicated_core_t
+{
+	k_thread_core_render,
+	k_thread_core_fs,
+
+	k_thread_dedicated_core_count,
+} thread_dedicated_core_t;
+
+enum
+{
+	k_thread_name_max = 32,
+};
+
+// Optional settings for a new thread.
+typedef struct thread_options_t
+{
+	// Debug name, truncated to k_thread_name_max - 1 characters.
+	// Shown in the debugger, trace captures and crash reports. May be NULL.
+	const char* name;
+	// Logical processors the thread may run on, one bit per processor. Zero leaves it unrestricted.
+	uint64_t affinity_mask;
+	thread_priority_t priority;
+} thread_options_t;
+
 //create a new thread that performs the given function
 thread_t* thread_create(int (*func) (void*), void* data);
 
+// Create a new thread with a name, affinity and priority.
+// Options are applied before the thread starts running.
+thread_t* thread_create_with_options(int (*func) (void*), void* data, const thread_options_t* options);
+
 // Waits for a thread to complete and destroys it.
 // Returns the thread's exit code.
-int thread_destroy(thread);
+int thread_destroy(thread_t* thread);
 
 // Puts the calling thread to sleep for the specified number of milliseconds.
 // Thread will sleep for *approximately* the specified time.
 void thread_sleep(uint32_t ms);
+
+// Get the number of logical processors available to the process.
+int thread_get_core_count();
+
+// Name the calling thread, for threads not started with thread_create_with_options (e.g. main).
+void thread_set_name(const char* name);
+
+// Get the calling thread's name, or an empty string if it was never named.
+const char* thread_get_name();
+
+// Get the mask of processors the process may run on.
+uint64_t thread_get_process_core_mask();
+
+// Get a single-processor mask reserved for a dedicated thread.
+// Returns zero (no pinning) when there are too few cores to set any aside.
+uint64_t thread_get_dedicated_core_mask(thread_dedicated_core_t core);
+
+// Get the mask of processors left for job workers once dedicated cores are set aside.
+uint64_t thread_get_worker_core_mask();
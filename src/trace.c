@@ -4,6 +4,7 @@
 #include "timer.h"
 #include "trace.h"
 #include "semaphore.h"
+#include "thread.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -13,6 +14,7 @@
 
 #define TRACE_BUFFER_INIT_SIZE 2048
 #define TRACE_TEMP_BUFFER_SIZE 512
+#define TRACE_MAX_THREADS 64
 
 typedef struct duration_t
 {
@@ -23,6 +25,12 @@ typedef struct duration_t
 	uint32_t thread_id;
 }duration_t;
 
+typedef struct trace_thread_t
+{
+	uint32_t thread_id;
+	char name[k_thread_name_max];
+}trace_thread_t;
+
 typedef struct trace_t
 {
 	duration_t** durations;
@@ -35,6 +43,8 @@ typedef struct trace_t
 	fs_t* fs;
 	char* write_path;
 	int trace_active;
+	trace_thread_t threads[TRACE_MAX_THREADS];
+	uint32_t thread_count;
 }trace_t;
 
 trace_t* trace_create(heap_t* heap, fs_t* fs, int event_capacity)
@@ -46,6 +56,7 @@ trace_t* trace_create(heap_t* heap, fs_t* fs, int event_capacity)
 	trace->durations = heap_alloc(heap, sizeof(duration_t*) * trace->duration_cap, 8);
 	trace->active_durations = heap_alloc(heap, sizeof(duration_t*) * trace->duration_cap, 8);
 	trace->trace_active = 0;
+	trace->thread_count = 0;
 	trace->heap = heap;
 	trace->fs = fs;
 	trace->semaphore = semaphore_create(1, 1);
@@ -73,6 +84,27 @@ void trace_destroy(trace_t* trace)
 	heap_free(trace->heap, trace);
 }
 
+// Remember the name of each named thread seen, so the capture can label it.
+// Must be called with the trace semaphore held.
+static void trace_register_thread(trace_t* trace, uint32_t thread_id)
+{
+	const char* name = thread_get_name();
+	if (name[0] == '\0' || trace->thread_count >= TRACE_MAX_THREADS)
+	{
+		return;
+	}
+	for (uint32_t k = 0; k < trace->thread_count; k++)
+	{
+		if (trace->threads[k].thread_id == thread_id)
+		{
+			return;
+		}
+	}
+	trace->threads[trace->thread_count].thread_id = thread_id;
+	strcpy_s(trace->threads[trace->thread_count].name, sizeof(trace->threads[trace->thread_count].name), name);
+	trace->thread_count++;
+}
+
 void trace_duration_push(trace_t* trace, const char* name)
 {
 	if (trace->duration_count >= trace->duration_cap)
@@ -96,6 +128,7 @@ void trace_duration_push(trace_t* trace, const char* name)
 	temp->thread_id = GetCurrentThreadId();
 
 	semaphore_aquire(trace->semaphore);
+	trace_register_thread(trace, temp->thread_id);
 	trace->durations[trace->duration_count] = temp;
 	trace->duration_count++;
 	trace->active_durations[trace->active_duration_count] = temp;
@@ -147,6 +180,19 @@ void trace_capture_stop(trace_t* trace)
 	uint32_t buffer_length = 0;
 	sprintf_s(json_buffer, TRACE_TEMP_BUFFER_SIZE, "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
 	buffer_length = (uint32_t) strlen(json_buffer);
+	for (uint32_t k = 0; k < trace->thread_count; k++)
+	{
+		char temp[TRACE_TEMP_BUFFER_SIZE];
+		sprintf_s(temp, TRACE_TEMP_BUFFER_SIZE, "\t\t{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":\"%u\",\"args\":{\"name\":\"%s\"}},\n",
+			trace->threads[k].thread_id, trace->threads[k].name);
+		if (buffer_length + strlen(temp) + 1 > buffer_capacity)
+		{
+			buffer_capacity *= 2;
+			json_buffer = heap_realloc(trace->heap, json_buffer, buffer_capacity, 8);
+		}
+		memcpy_s(json_buffer + buffer_length, buffer_capacity, temp, strlen(temp) + 1);
+		buffer_length = (uint32_t) strlen(json_buffer);
+	}
 	for (uint32_t k = 0; k < trace->duration_count; k++)
 	{
 		char temp[TRACE_TEMP_BUFFER_SIZE];